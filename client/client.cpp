@@ -1,4 +1,5 @@
 #include "client.h"
+#include "../server/server.h"
 #include <QDir>
 #include <QFile>
 #include <QJsonArray>
@@ -9,17 +10,15 @@
 
 Client::Client(const QString &userId, const QString &username,
                const QString &email)
-    : userId(userId), username(username), email(email) {
+    : userId(userId), username(username), email(email),
+      handle(UserIds::getInstance()->intern(userId)), dirty(false) {
+    // Contacts and rooms are handed over by the server (see hydrate)
     qDebug() << "Creating client for user:" << userId;
-    loadContacts();
 }
 
 Client::~Client() {
-    saveContacts();
-    // Clean up rooms
-    for (Room *room : rooms) {
-        delete room;
-    }
+    saveIfDirty();
+    // The rooms belong to the server's userRooms (see server::saveClientData)
     rooms.clear();
 }
 
@@ -40,142 +39,40 @@ bool Client::hasContact(const QString &contactId) const {
 }
 
 Room *Client::getRoom(const QString &roomId) {
-    if (rooms.contains(roomId)) {
-        return rooms[roomId];
-    }
-    return nullptr;
+    return rooms.value(UserIds::getInstance()->findRoomKeyForRoomId(roomId), nullptr);
 }
 
 Room *Client::getRoomWithUser(const QString &userId) {
-    // Always use this user's email for consistency
-    QString thisUserEmail = this->email;
-    
-    // For the other user, ensure we're using their email
-    QString otherUserEmail = userId;
-    
-    // Log detailed room lookup information - ENHANCED DEBUG
-    qDebug() << "\n\n======== ENHANCED ROOM LOOKUP DEBUG ========";
-    qDebug() << "Current user: " << thisUserEmail;
-    qDebug() << "Target user: " << otherUserEmail;
-    
-    // First try exact match with the consistent ID generation
-    QString expectedRoomId = Room::generateRoomId(thisUserEmail, otherUserEmail);
-    qDebug() << "Generated expected room ID: '" << expectedRoomId << "'";
-    
-    // Debug all available rooms with more details
-    qDebug() << "Available rooms in memory (" << rooms.size() << "):";
-    for (auto it = rooms.begin(); it != rooms.end(); ++it) {
-        qDebug() << " - Room ID: '" << it.key() << "' Room Name: '" << it.value()->getName() << "'";
-        qDebug() << "   Room ID equal to expected? " << (it.key() == expectedRoomId ? "YES" : "NO");
-        qDebug() << "   Case insensitive match? " << (it.key().compare(expectedRoomId, Qt::CaseInsensitive) == 0 ? "YES" : "NO");
-    }
-    
-    // Check for exact match (case insensitive)
-    for (auto it = rooms.begin(); it != rooms.end(); ++it) {
-        if (it.key().compare(expectedRoomId, Qt::CaseInsensitive) == 0) {
-            qDebug() << "Found existing room by case-insensitive ID: '" << it.key() << "'";
-            qDebug() << "======== END ENHANCED ROOM LOOKUP DEBUG ========\n\n";
-            return it.value();
-        }
-    }
-    
-    if (rooms.contains(expectedRoomId)) {
-        qDebug() << "Found existing room by exact ID match: '" << expectedRoomId << "'";
-        qDebug() << "======== END ENHANCED ROOM LOOKUP DEBUG ========\n\n";
-        return rooms[expectedRoomId];
-    }
-    
-    // Log that we're falling back to alternative search methods
-    qDebug() << "Room not found by expected ID, trying fallback methods...";
-    
-    // Check for an exact file match first - NEW DIRECT FILE CHECK
-    QString roomFilePath = "../db/rooms/" + expectedRoomId + ".txt";
-    QFile roomFile(roomFilePath);
-    if (roomFile.exists()) {
-        qDebug() << "FOUND ROOM FILE DIRECTLY at: " << roomFilePath;
-        qDebug() << "But no matching room object in memory! Creating new room object.";
-        
-        // Create a new room object for this file
-        Room *newRoom = new Room(expectedRoomId);
-        newRoom->loadMessages();
-        rooms[expectedRoomId] = newRoom;
-        
-        qDebug() << "Created and loaded new room object from file: " << expectedRoomId;
-        qDebug() << "======== END ENHANCED ROOM LOOKUP DEBUG ========\n\n";
-        return newRoom;
-    } else {
-        qDebug() << "Room file does NOT exist directly at: " << roomFilePath;
+    // Rooms are keyed by the two participants' handles, so this is an
+    // integer hash lookup
+    QString otherUserEmail = server::normalizeUserId(userId);
+    UserHandle other = UserIds::getInstance()->find(otherUserEmail);
+    if (other == 0) {
+        qDebug() << "No room found for users" << email << "and" << otherUserEmail;
+        return nullptr; // Never seen, so no room can name them
     }
-    
-    // Try to read all files in the rooms directory
-    QDir roomsDir("../db/rooms");
-    QStringList roomFiles = roomsDir.entryList(QDir::Files);
-    qDebug() << "All room files in directory (" << roomFiles.size() << "):";
-    for (const QString &file : roomFiles) {
-        qDebug() << " - '" << file << "'";
-        
-        QString fileNameWithoutExt = file;
-        if (fileNameWithoutExt.endsWith(".txt")) {
-            fileNameWithoutExt.chop(4);
-        }
-        
-        // Check if this file matches our expected room ID
-        if (fileNameWithoutExt.compare(expectedRoomId, Qt::CaseInsensitive) == 0) {
-            qDebug() << "FOUND MATCHING ROOM FILE: '" << file << "'";
-            qDebug() << "But no matching room object in memory! Creating new room object.";
-            
-            // Create a new room object for this file
-            Room *newRoom = new Room(fileNameWithoutExt);
-            newRoom->loadMessages();
-            rooms[fileNameWithoutExt] = newRoom;
-            
-            qDebug() << "Created and loaded new room object from file: " << fileNameWithoutExt;
-            qDebug() << "======== END ENHANCED ROOM LOOKUP DEBUG ========\n\n";
-            return newRoom;
-        }
+    RoomKey key = UserIds::roomKey(handle, other);
+
+    auto it = rooms.constFind(key);
+    if (it != rooms.constEnd()) {
+        return it.value();
     }
-    
-    // Legacy fallback - try to find a room containing both user IDs exactly as they are
-    for (auto it = rooms.begin(); it != rooms.end(); ++it) {
-        Room* room = it.value();
-        QString roomId = room->getRoomId();
-        qDebug() << "Checking room ID: '" << roomId << "'";
-        
-        // Check room ID parts
-        QStringList roomUsers = roomId.split('_');
-        qDebug() << "  Room parts:";
-        for (const QString &part : roomUsers) {
-            qDebug() << "    - '" << part << "'";
-        }
-        
-        // Check if this room contains both users (using exact ID matches)
-        bool containsThisUser = false;
-        bool containsOtherUser = false;
-        
-        // Case insensitive comparison for each part
-        for (const QString &part : roomUsers) {
-            if (part.compare(thisUserEmail, Qt::CaseInsensitive) == 0) {
-                containsThisUser = true;
-                qDebug() << "  Found current user in room part: '" << part << "'";
-            }
-            if (part.compare(otherUserEmail, Qt::CaseInsensitive) == 0) {
-                containsOtherUser = true;
-                qDebug() << "  Found target user in room part: '" << part << "'";
-            }
-        }
-        
-        if (containsThisUser && containsOtherUser) {
-            qDebug() << "Found existing room by matching both users: '" << roomId << "'";
-            qDebug() << "======== END ENHANCED ROOM LOOKUP DEBUG ========\n\n";
-            return room;
-        }
+
+    // Not open in this client yet: ask the server's room directory, which
+    // knows every room on disk without touching the filesystem
+    QString knownRoomId = server::getInstance()->findRoomId(key);
+    if (knownRoomId.isEmpty()) {
+        qDebug() << "No room found for users" << email << "and" << otherUserEmail;
+        return nullptr;
     }
-    
-    // If we reach here, we still haven't found a room
-    // Check if we should create a new room
-    qDebug() << "No room found for users " << thisUserEmail << " and " << otherUserEmail;
-    qDebug() << "======== END ENHANCED ROOM LOOKUP DEBUG ========\n\n";
-    return nullptr;
+
+    Room *room = new Room(knownRoomId);
+    room->setRoomId(knownRoomId);
+    room->loadMessages();
+    rooms[key] = room;
+    dirty = true;
+    qDebug() << "Opened room" << knownRoomId << "from the room directory";
+    return room;
 }
 
 Room *Client::createRoom(const QString &otherUserId) {
@@ -193,8 +90,8 @@ Room *Client::createRoom(const QString &otherUserId) {
     // Always use this user's email (not nickname) for consistency
     QString thisUserEmail = this->email; // Use the email property
     
-    // For the other user, ensure we're using their email
-    QString otherUserEmail = otherUserId;
+    // For the other user, ensure we're using their canonical email
+    QString otherUserEmail = server::normalizeUserId(otherUserId);
     
     // Debug info
     qDebug() << "Creating new room between '" << thisUserEmail << "' and '" << otherUserEmail << "'";
@@ -214,7 +111,7 @@ Room *Client::createRoom(const QString &otherUserId) {
     }
     
     // Add to room map
-    rooms[room->getRoomId()] = room;
+    rooms[room->getKey()] = room;
     qDebug() << "Added room to memory with ID: '" << room->getRoomId() << "'";
     
     // Create the room file on disk if it doesn't exist
@@ -228,6 +125,9 @@ Room *Client::createRoom(const QString &otherUserId) {
             qDebug() << "ERROR: Failed to create room file: " << roomFile.errorString();
         }
     }
+
+    // Make the new room resolvable for both participants
+    server::getInstance()->registerRoom(room->getKey(), roomName);
     
     // Save contacts to update the user file with the new room
     saveContacts();
@@ -238,9 +138,9 @@ Room *Client::createRoom(const QString &otherUserId) {
 }
 
 void Client::removeRoom(const QString &roomId) {
-    if (rooms.contains(roomId)) {
-        delete rooms[roomId];
-        rooms.remove(roomId);
+    // The server frees the Room once it sees it gone (saveClientData)
+    if (rooms.remove(UserIds::getInstance()->findRoomKeyForRoomId(roomId)) > 0) {
+        dirty = true;
     }
 }
 
@@ -273,109 +173,68 @@ void Client::saveContacts() {
         }
         
         file.close();
+        dirty = false;
     } else {
         qDebug() << "Failed to open file for writing:" << file.errorString();
     }
 }
 
+void Client::saveIfDirty() {
+    if (dirty) {
+        saveContacts();
+    }
+}
+
 void Client::loadContacts() {
     QString filename = "../db/users/" + userId + ".txt";
-    qDebug() << "\n\n======== LOADING CONTACTS AND ROOMS ========";
-    qDebug() << "Loading contacts and rooms for user:" << userId;
-    qDebug() << "Loading from file:" << filename;
-    
-    // First, debug all room files in the database
-    QDir roomsDir("../db/rooms");
-    QStringList roomFiles = roomsDir.entryList(QDir::Files);
-    qDebug() << "Available room files in database (" << roomFiles.size() << "):";
-    for (const QString &roomFile : roomFiles) {
-        QString fileId = roomFile;
-        if (fileId.endsWith(".txt")) fileId.chop(4);
-        qDebug() << " - Room file: '" << fileId << "'";
-    }
+    qDebug() << "Loading contacts and rooms for user:" << userId << "from" << filename;
+
+    server *srv = server::getInstance();
     
     QFile file(filename);
     if (file.open(QIODevice::ReadOnly | QIODevice::Text)) {
         QTextStream in(&file);
         contacts.clear();
         rooms.clear(); // Clear existing rooms to prevent duplicates
-        qDebug() << "Cleared existing contacts and rooms in memory.";
+        dirty = false; // In step with the file unless a room has to be repaired below
         
         while (!in.atEnd()) {
             QString line = in.readLine().trimmed();
             if (line.startsWith("CONTACT:")) {
-                QString contactId = line.mid(8).trimmed();
+                QString contactId = server::normalizeUserId(line.mid(8));
                 contacts.append(contactId);
-                qDebug() << "Loaded contact: '" << contactId << "'";
             } else if (line.startsWith("ROOM:")) {
                 QStringList parts = line.mid(5).split('|');
                 if (parts.size() >= 2) {
                     QString roomId = parts[0].trimmed(); // Trim any whitespace
                     QString roomName = parts[1].trimmed(); // Trim any whitespace
-                    qDebug() << "Found room in user file - ID: '" << roomId << "' Name: '" << roomName << "'";
 
-                    // Check if room file exists first (in any case)
-                    bool roomFileExists = false;
-                    QString actualRoomFileName = "";
-                    
-                    // Direct check first
-                    QString directPath = "../db/rooms/" + roomId + ".txt";
-                    if (QFile::exists(directPath)) {
-                        roomFileExists = true;
-                        actualRoomFileName = roomId;
-                        qDebug() << "Room file exists directly at: " << directPath;
-                    } else {
-                        // Case-insensitive search
-                        for (const QString &roomFile : roomFiles) {
-                            QString fileId = roomFile;
-                            if (fileId.endsWith(".txt")) fileId.chop(4);
-                            
-                            if (fileId.compare(roomId, Qt::CaseInsensitive) == 0) {
-                                roomFileExists = true;
-                                actualRoomFileName = fileId;
-                                qDebug() << "Found room file with case-insensitive match: '" << fileId << "'";
-                                break;
-                            }
-                        }
-                    }
-                    
-                    if (roomFileExists) {
-                        // Create room directly with the name from file
+                    // The server's room directory already knows which room
+                    // files exist, so no filesystem probing is needed here
+                    if (srv->hasRoom(roomId)) {
                         Room *room = new Room(roomName);
-                        
-                        // Set the exact room ID to match what's on disk
-                        if (!actualRoomFileName.isEmpty()) {
-                            room->setRoomId(actualRoomFileName);
-                            qDebug() << "Set room ID from actual file: '" << actualRoomFileName << "'";
-                        } else {
-                            room->setRoomId(roomId);
-                            qDebug() << "Set room ID from user file: '" << roomId << "'";
-                        }
-                        
-                        // Store the room in the rooms map
-                        rooms[room->getRoomId()] = room;
-                        qDebug() << "Added room to memory - ID: '" << room->getRoomId() << "' Name: '" << room->getName() << "'";
+                        room->setRoomId(roomId);
+                        rooms[room->getKey()] = room;
                         
                         // Pre-load messages for rooms - OPTIONAL BUT HELPFUL
                         room->loadMessages();
-                        qDebug() << "Loaded " << room->getMessages().size() << " messages for room";
                     } else {
                         qDebug() << "WARNING: Room file does not exist for: '" << roomId << "', creating empty file";
                         
                         // Generate correct room ID for consistency
-                        QStringList userParts = roomName.split('_');
-                        if (userParts.size() == 2) {
+                        QString userA, userB;
+                        if (Room::splitRoomId(roomName, userA, userB)) {
                             // Create the file if it doesn't exist
                             QFile newRoomFile("../db/rooms/" + roomId + ".txt");
                             if (newRoomFile.open(QIODevice::WriteOnly | QIODevice::Text)) {
                                 newRoomFile.close();
-                                qDebug() << "Created new empty room file: '" << roomId << ".txt'";
                                 
                                 // Create the room in memory
                                 Room *room = new Room(roomName);
                                 room->setRoomId(roomId);
-                                rooms[roomId] = room;
-                                qDebug() << "Added new empty room to memory";
+                                rooms[room->getKey()] = room;
+                                srv->registerRoom(room->getKey(), roomId);
+                                dirty = true;
                             } else {
                                 qDebug() << "ERROR: Failed to create room file: " << newRoomFile.errorString();
                             }
@@ -392,20 +251,49 @@ void Client::loadContacts() {
     } else {
         qDebug() << "ERROR: Failed to open user file: " << file.errorString();
     }
-    
-    // Verify rooms were properly loaded
-    qDebug() << "Rooms after loading (" << rooms.size() << "):";
-    for (auto it = rooms.begin(); it != rooms.end(); ++it) {
-        qDebug() << " - Room ID: '" << it.key() << "' Name: '" << it.value()->getName() << "'";
+}
+
+qint64 Client::residentBytes() const {
+    qint64 bytes = sizeof(Client);
+    bytes += (userId.capacity() + username.capacity() + email.capacity()) * qint64(sizeof(QChar));
+    for (const QString &contactId : contacts) {
+        bytes += sizeof(QString) + contactId.capacity() * qint64(sizeof(QChar));
     }
-    
-    qDebug() << "======== COMPLETED LOADING CONTACTS AND ROOMS ========\n\n";
+    for (Room *room : rooms) {
+        bytes += sizeof(RoomKey) + sizeof(Room *) + sizeof(Room);
+        bytes += (room->getRoomId().capacity() + room->getName().capacity()) * qint64(sizeof(QChar));
+    }
+    return bytes;
+}
+
+void Client::hydrate(const QVector<QString>& contactList, const QList<Room*>& roomList) {
+    for (const QString &contactId : contactList) {
+        QString canonical = server::normalizeUserId(contactId);
+        if (!contacts.contains(canonical)) {
+            contacts.append(canonical);
+        }
+    }
+
+    for (Room *room : roomList) {
+        if (room && room->getKey() != 0) {
+            rooms[room->getKey()] = room;
+        }
+    }
+    qDebug() << "Client" << userId << "hydrated with" << contacts.size()
+             << "contacts and" << rooms.size() << "rooms";
 }
 
 void Client::addRoom(Room* room) {
     if (!room) return;
     
-    // Store room by its ID
-    rooms[room->getRoomId()] = room;
+    // Legacy hash-named rooms have no participant key to store them under
+    if (room->getKey() == 0) {
+        qDebug() << "Cannot add room without participants:" << room->getRoomId();
+        return;
+    }
+
+    // Store room by its participant key
+    rooms[room->getKey()] = room;
+    dirty = true;
     qDebug() << "Added existing room:" << room->getRoomId() << "to client" << userId;
 }
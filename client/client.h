@@ -4,6 +4,7 @@
 #include <QString>
 #include <QVector>
 #include <QMap>
+#include <QHash>
 #include "room.h"
 
 class Client {
@@ -11,8 +12,10 @@ private:
     QString userId;
     QString username;
     QString email;
+    UserHandle handle;            // Interned form of userId used for room keys
     QVector<QString> contacts;
-    QMap<QString, Room*> rooms;  // Map of roomId to Room pointer
+    QHash<RoomKey, Room*> rooms;  // Packed participant key -> Room; the server owns the Rooms
+    bool dirty;                   // Contacts/rooms changed since the user file was written
 
 public:
     Client(const QString& userId, const QString& username, const QString& email);
@@ -22,6 +25,7 @@ public:
     QString getUserId() const { return userId; }
     QString getUsername() const { return username; }
     QString getEmail() const { return email; }
+    UserHandle getHandle() const { return handle; }
     QVector<QString> getContacts() const { return contacts; }
 
     // Contact management
@@ -41,7 +45,17 @@ public:
 
     // File operations
     void saveContacts();
+    void saveIfDirty();  // Write the user file only if it changed
     void loadContacts();
+    bool isDirty() const { return dirty; }
+
+    // Approximate heap footprint of this client (contacts and room views;
+    // room histories are accounted for by the RoomLogStore)
+    qint64 residentBytes() const;
+
+    // Take contacts and rooms the server already loaded, without touching
+    // the user file or marking it dirty
+    void hydrate(const QVector<QString>& contacts, const QList<Room*>& rooms);
 };
 
 #endif // CLIENT_H 
\ No newline at end of file
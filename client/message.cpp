@@ -11,31 +11,47 @@ Message::Message()
     : content(""), 
       sender(""), 
       timestamp(QDateTime::currentDateTime()), 
-      isRead(false) {}
+      isRead(false),
+      seq(0) {}
 
 Message::Message(const QString& content, const QString& sender) 
     : content(content), 
       sender(sender), 
       timestamp(QDateTime::currentDateTime()), 
-      isRead(false) {}
+      isRead(false),
+      seq(0) {}
+
+Message::Message(const QString& content, const QString& sender,
+                 const QDateTime& timestamp, bool isRead, quint64 seq)
+    : content(content),
+      sender(sender),
+      timestamp(timestamp),
+      isRead(isRead),
+      seq(seq) {}
 
 QString Message::toString() const {
     // Improved serialization format with better separation
-    return QString("%1|%2|%3|%4")
+    // The sequence number is appended last so older 4-field lines still parse
+    return QString("%1|%2|%3|%4|%5")
         .arg(sender)
         .arg(content)
         .arg(timestamp.toString(Qt::ISODate))
-        .arg(isRead ? "1" : "0");
+        .arg(isRead ? "1" : "0")
+        .arg(seq);
 }
 
 Message Message::fromString(const QString& str) {
     QStringList parts = str.split("|");
-    if (parts.size() == 4) {
+    if (parts.size() == 4 || parts.size() == 5) {
         Message msg(parts[1], parts[0]);
         msg.timestamp = QDateTime::fromString(parts[2], Qt::ISODate);
         if (parts[3] == "1") {
             msg.markAsRead();
         }
+        // Legacy lines have no sequence number; the room assigns one on load
+        if (parts.size() == 5) {
+            msg.seq = parts[4].toULongLong();
+        }
         return msg;
     }
     qDebug() << "Invalid message format:" << str;
@@ -50,5 +66,6 @@ bool Message::operator==(const Message& other) const {
     return content == other.content &&
            sender == other.sender &&
            timestamp == other.timestamp &&
-           isRead == other.isRead;
+           isRead == other.isRead &&
+           seq == other.seq;
 }
@@ -3,6 +3,7 @@
 
 #include <QString>
 #include <QDateTime>
+#include <QtGlobal>
 
 class Message {
 private:
@@ -10,20 +11,27 @@ private:
     QString sender;
     QDateTime timestamp;
     bool isRead;
+    quint64 seq; // Per-room sequence number, 0 until the room assigns one
 
 public:
     // Add default constructor
     Message();
     Message(const QString &content, const QString &sender);
+    // Full constructor, used when materializing a stored record for the UI
+    Message(const QString &content, const QString &sender,
+            const QDateTime &timestamp, bool isRead, quint64 seq);
     
     // Getters
     QString getContent() const { return content; }
     QString getSender() const { return sender; }
     QDateTime getTimestamp() const { return timestamp; }
     bool getReadStatus() const { return isRead; }
+    quint64 getSeq() const { return seq; }
 
     // Methods
     void markAsRead();
+    void setSeq(quint64 value) { seq = value; }
+    void setContent(const QString &text) { content = text; }
     bool operator==(const Message &other) const;
     
     // Serialization
@@ -1,29 +1,37 @@
 #include "room.h"
-#include <QFile>
-#include <QTextStream>
-#include <QDir>
 #include <QDebug>
 
 QString Room::generateRoomId(const QString& user1, const QString& user2) {
-    // Ensure we have complete email addresses
-    qDebug() << "Generating room ID for users:" << user1 << "and" << user2;
-    
-    // No need to normalize - we should always be getting email addresses
+    // User IDs are normalized when they enter the system, so no case folding here
     // Sort the user IDs to ensure consistent room ID regardless of order
-    QString roomId = user1 < user2 ? 
-                    user1 + "_" + user2 : 
-                    user2 + "_" + user1;
-    
-    qDebug() << "Generated room ID:" << roomId;
-    return roomId;
+    return user1 < user2 ? 
+           user1 + "_" + user2 : 
+           user2 + "_" + user1;
 }
 
-Room::Room(const QString& name) : name(name) {
+bool Room::splitRoomId(const QString& roomId, QString& userA, QString& userB) {
+    int at = roomId.indexOf('@');
+    if (at < 0) {
+        return false;
+    }
+    int sep = roomId.indexOf('_', at);
+    if (sep <= 0 || sep == roomId.size() - 1) {
+        return false;
+    }
+    userA = roomId.left(sep);
+    userB = roomId.mid(sep + 1);
+    return true;
+}
+
+Room::Room(const QString& name) : name(name), key(0) {
     // Extract user IDs from the room name
-    QStringList userIds = name.split("_");
-    if (userIds.size() == 2) {
+    QString userA, userB;
+    if (splitRoomId(name, userA, userB)) {
         // Use the sorted user IDs directly as the room ID
-        roomId = generateRoomId(userIds[0], userIds[1]);
+        roomId = generateRoomId(userA, userB);
+        // Interned the way roomKeyForRoomId does, so an unnormalized name
+        // cannot add a second handle for the same user
+        key = UserIds::getInstance()->roomKeyForRoomId(roomId);
     } else {
         // Fallback if name format is unexpected
         roomId = name;
@@ -31,105 +39,70 @@ Room::Room(const QString& name) : name(name) {
     lastActivity = QDateTime::currentDateTime();
 }
 
-// Convert QVector to QList and set messages
-void Room::setMessages(const QVector<Message>& msgs) {
-    messages.clear();
-    
-    // Add messages in chronological order to the list
-    for (int i = 0; i < msgs.size(); i++) {
-        messages.append(msgs.at(i));
+void Room::setRoomId(const QString& id) {
+    if (id != roomId) {
+        log.clear(); // Point at the new room's log on next use
     }
+    roomId = id;
+    key = UserIds::getInstance()->roomKeyForRoomId(id);
 }
 
-// Convert messages list to vector for compatibility
-QVector<Message> Room::getMessagesAsVector() const {
-    QVector<Message> result;
-    
-    // Simply copy from list to vector (already in chronological order)
-    for (const Message& msg : messages) {
-        result.append(msg);
+RoomLog* Room::messageLog() const {
+    if (!log) {
+        log = RoomLogStore::getInstance()->acquire(roomId.trimmed());
+    } else {
+        // The store may have spilled the log to stay within its memory budget
+        log->ensureLoaded();
+        log->touch();
     }
-    
-    return result;
+    return log.data();
+}
+
+void Room::setMessages(const QList<Message>& msgs) {
+    messageLog()->replaceAll(msgs.toVector());
+}
+
+void Room::setMessages(const QVector<Message>& msgs) {
+    messageLog()->replaceAll(msgs);
+}
+
+Message Room::getMessageBySeq(quint64 seq) const {
+    int index = indexOfSeq(seq);
+    if (index >= 0) {
+        return messageLog()->at(index);
+    }
+    return Message(); // seq 0 means not found
 }
 
 // Get the latest message
 Message Room::getLatestMessage() const {
-    if (!messages.isEmpty()) {
-        return messages.last();  // Return last message (newest) in the list
+    RoomLog *messages = messageLog();
+    if (!messages->isEmpty()) {
+        return messages->at(messages->size() - 1);  // Newest message is last
     }
-    return Message(); // Return empty message if list is empty
+    return Message(); // Return empty message if the log is empty
 }
 
-void Room::addMessage(const Message& msg) {
-    // Add new message to the end of the list
-    messages.append(msg);
+quint64 Room::addMessage(const Message& msg) {
     lastActivity = QDateTime::currentDateTime();
+    return messageLog()->append(msg);
+}
+
+bool Room::updateMessageContent(quint64 seq, const QString& content) {
+    return messageLog()->updateContent(seq, content);
 }
 
 void Room::removeMessage(int index) {
-    if (index >= 0 && index < messages.size()) {
-        messages.removeAt(index);
-    }
+    messageLog()->removeAt(index);
 }
 
 void Room::clearMessages() {
-    messages.clear();
+    messageLog()->clear();
 }
 
 void Room::loadMessages() {
-    messages.clear(); // Clear existing messages to avoid duplicates
-
-    // Make sure roomId is clean (no whitespace)
-    roomId = roomId.trimmed();
-    
-    // First attempt with the direct room ID
-    QString roomFile = "../db/rooms/" + roomId + ".txt";
-    QFile file(roomFile);
-    
-    // If the file doesn't exist directly, try a case-insensitive search
-    if (!file.exists()) {
-        qDebug() << "Room file not found directly:" << roomFile;
-        QDir roomsDir("../db/rooms");
-        QStringList roomFiles = roomsDir.entryList(QDir::Files);
-        
-        bool foundFile = false;
-        for (const QString &possibleFile : roomFiles) {
-            QString fileId = possibleFile;
-            if (fileId.endsWith(".txt")) fileId.chop(4);
-            
-            if (fileId.compare(roomId, Qt::CaseInsensitive) == 0) {
-                roomFile = "../db/rooms/" + possibleFile;
-                qDebug() << "Found room file with case-insensitive match:" << possibleFile;
-                foundFile = true;
-                file.setFileName(roomFile);
-                break;
-            }
-        }
-        
-        if (!foundFile) {
-            qDebug() << "WARNING: No matching room file found for ID:" << roomId;
-        }
-    }
-
-    qDebug() << "Loading messages from file:" << roomFile;
-
-    if (file.open(QIODevice::ReadOnly | QIODevice::Text)) {
-        QTextStream in(&file);
-        
-        while (!in.atEnd()) {
-            QString line = in.readLine().trimmed();
-            if (!line.isEmpty()) {
-                Message msg = Message::fromString(line);
-                messages.append(msg);
-            }
-        }
-        file.close();
-        
-        qDebug() << "Loaded" << messages.size() << "messages from file";
-    } else {
-        qDebug() << "Failed to open file for reading:" << file.errorString();
-    }
+    // Every view shares one log, so the file only needs reading once
+    messageLog()->ensureLoaded();
 }
 
 void Room::updateLastActivity() {
@@ -137,33 +110,13 @@ void Room::updateLastActivity() {
 }
 
 void Room::saveMessages() {
-    QString roomFile = "../db/rooms/" + roomId + ".txt";
-    qDebug() << "Saving all messages to file:" << roomFile;
-    
-    // Create the rooms directory if it doesn't exist
-    QDir dir("../db/rooms");
-    if (!dir.exists()) {
-        dir.mkpath(".");
-    }
-    
-    QFile file(roomFile);
-    if (file.open(QIODevice::WriteOnly | QIODevice::Text)) {
-        QTextStream out(&file);
-        
-        // Just iterate through the list directly (already in chronological order)
-        for (const Message& msg : messages) {
-            out << msg.toString() << "\n";
-        }
-        
-        file.close();
-        qDebug() << "Saved" << messages.size() << "messages to file";
-    } else {
-        qDebug() << "Failed to open file for writing:" << file.errorString();
-    }
+    messageLog()->save();
 }
 
 Room::~Room() {
-    // Save messages before destruction
-    saveMessages();
-    qDebug() << "Room" << roomId << "destroyed and messages saved";
+    // The shared log outlives this view; only write it if it has unsaved changes
+    if (log) {
+        log->saveIfDirty();
+    }
+    qDebug() << "Room" << roomId << "destroyed";
 }
@@ -6,14 +6,22 @@
 #include <QList> // 
 #include <QDateTime>
 #include "message.h"
+#include "userids.h"
+#include "roomlog.h"
 
+// A participant's view of a conversation. The messages themselves live in the
+// room's shared RoomLog, so any number of Room objects can point at the same
+// history without copying it.
 class Room {
 private:
     QString roomId;
     QString name;
-    QList<Message> messages;
+    RoomKey key;            // Packed participant handles (0 for legacy room IDs)
+    mutable RoomLogPtr log; // Shared history, looked up on first use
     QDateTime lastActivity;
 
+    RoomLog* messageLog() const;
+
 public:
     Room(const QString& name);
     ~Room();
@@ -21,35 +29,61 @@ public:
     // Getters
     QString getRoomId() const { return roomId; }
     QString getName() const { return name; }
+    RoomKey getKey() const { return key; }
     
-    // Message access methods with List implementation
-    QList<Message> getMessages() const { return messages; } // 
+    // Message access goes to the shared log; these build Message objects, so
+    // prefer the paged/seq lookups below for large rooms
+    QVector<Message> getMessages() const { return messageLog()->getMessages(); }
+    RoomLogPtr getLog() const { messageLog(); return log; }
+    bool isEmpty() const { return messageLog()->isEmpty(); }
+    int messageCount() const { return messageLog()->size(); }
 
     
-    QVector<Message> getMessagesAsVector() const;
+    QVector<Message> getMessagesAsVector() const { return messageLog()->getMessages(); }
     
     // Get the most recent message without removing it
     Message getLatestMessage() const;
     
     QDateTime getLastActivity() const { return lastActivity; }
+    quint64 getLastSeq() const { return messageLog()->getLastSeq(); }
+    
+    // Sequence-number lookups (messages are kept sorted by seq)
+    int indexOfSeq(quint64 seq) const { return messageLog()->indexOfSeq(seq); }
+    Message getMessageBySeq(quint64 seq) const;
+    bool containsSeq(quint64 seq) const { return indexOfSeq(seq) >= 0; }
+    
+    // Pagination: up to `limit` messages older than beforeSeq (0 = newest page)
+    QVector<Message> getMessagesBefore(quint64 beforeSeq, int limit) const {
+        return messageLog()->getMessagesBefore(beforeSeq, limit);
+    }
+    // All messages newer than afterSeq, in order
+    QVector<Message> getMessagesAfter(quint64 afterSeq) const {
+        return messageLog()->getMessagesAfter(afterSeq);
+    }
     
     // Setter for roomId (for ensuring consistency)
-    void setRoomId(const QString& id) { roomId = id; }
+    void setRoomId(const QString& id);
     
     // Message setters
-    void setMessages(const QList<Message>& msgs) { messages = msgs; }
+    void setMessages(const QList<Message>& msgs);
     void setMessages(const QVector<Message>& msgs);
 
     // Message management
-    void addMessage(const Message& msg);
+    quint64 addMessage(const Message& msg); // Returns the assigned sequence number
+    bool updateMessageContent(quint64 seq, const QString& content);
     void removeMessage(int index);
     void clearMessages();
-    void loadMessages();  // Load from file to memory
+    void loadMessages();  // Make sure the shared log has been read from disk
     void saveMessages();  // Save from memory to file
     void updateLastActivity();
 
     // Static helper method to generate consistent room ID based on usernames without hashing
     static QString generateRoomId(const QString& user1, const QString& user2);
+
+    // Split a "userA_userB" room ID back into its participants. Emails may
+    // contain '_' but domains cannot, so the separator is the first '_' after
+    // the first '@'. Returns false for IDs that do not name two users.
+    static bool splitRoomId(const QString& roomId, QString& userA, QString& userB);
 };
 
-#endif // ROOM_H
\ No newline at end of file
+#endif // ROOM_H
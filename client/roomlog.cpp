@@ -0,0 +1,435 @@
+#include "roomlog.h"
+#include <QFile>
+#include <QTextStream>
+#include <QDir>
+#include <QDebug>
+
+RoomLog::RoomLog(const QString& roomId)
+    : roomId(roomId), lastSeq(0), loaded(false), version(0), savedVersion(0),
+      referenced(true) {
+}
+
+MessageRecord RoomLog::makeRecord(const Message& msg) {
+    QByteArray text = msg.getContent().toUtf8();
+    QDateTime timestamp = msg.getTimestamp();
+
+    MessageRecord record;
+    record.timestampMs = timestamp.isValid() ? timestamp.toMSecsSinceEpoch() : 0;
+    record.seq = msg.getSeq();
+    record.textOffset = quint32(arena.size());
+    record.textLength = quint32(text.size());
+    // Legacy lines may predate ID normalization
+    record.sender = UserIds::getInstance()->intern(msg.getSender().trimmed().toLower());
+    record.flags = 0;
+    if (msg.getReadStatus()) {
+        record.flags |= MessageRecord::ReadFlag;
+    }
+    if (!timestamp.isValid()) {
+        record.flags |= MessageRecord::InvalidTimestampFlag;
+    }
+
+    arena.append(text);
+    return record;
+}
+
+Message RoomLog::toMessage(const MessageRecord& record) const {
+    QDateTime timestamp;
+    if (!(record.flags & MessageRecord::InvalidTimestampFlag)) {
+        timestamp = QDateTime::fromMSecsSinceEpoch(record.timestampMs);
+    }
+    return Message(textOf(record),
+                   UserIds::getInstance()->idOf(record.sender),
+                   timestamp,
+                   (record.flags & MessageRecord::ReadFlag) != 0,
+                   record.seq);
+}
+
+QVector<Message> RoomLog::getMessages() const {
+    QVector<Message> result;
+    result.reserve(records.size());
+    for (const MessageRecord &record : records) {
+        result.append(toMessage(record));
+    }
+    return result;
+}
+
+void RoomLog::renumberFrom(int index) {
+    quint64 seq = index > 0 ? records.at(index - 1).seq : 0;
+    for (int i = index; i < records.size(); i++) {
+        // Keep persisted numbers, fill gaps left by legacy lines
+        MessageRecord &record = records[i];
+        if (record.seq <= seq) {
+            record.seq = seq + 1;
+        }
+        seq = record.seq;
+    }
+    lastSeq = seq;
+}
+
+// Binary search, since sequence numbers only ever grow along the log
+int RoomLog::indexOfSeq(quint64 seq) const {
+    int lo = 0;
+    int hi = records.size() - 1;
+    while (lo <= hi) {
+        int mid = lo + (hi - lo) / 2;
+        quint64 midSeq = records.at(mid).seq;
+        if (midSeq == seq) {
+            return mid;
+        }
+        if (midSeq < seq) {
+            lo = mid + 1;
+        } else {
+            hi = mid - 1;
+        }
+    }
+    return -1;
+}
+
+QVector<Message> RoomLog::getMessagesBefore(quint64 beforeSeq, int limit) const {
+    QVector<Message> result;
+
+    // Find the first message at or after beforeSeq; everything before it qualifies
+    int end = records.size();
+    if (beforeSeq != 0) {
+        int lo = 0;
+        int hi = records.size();
+        while (lo < hi) {
+            int mid = lo + (hi - lo) / 2;
+            if (records.at(mid).seq < beforeSeq) {
+                lo = mid + 1;
+            } else {
+                hi = mid;
+            }
+        }
+        end = lo;
+    }
+
+    int start = limit > 0 ? qMax(0, end - limit) : 0;
+    result.reserve(end - start);
+    for (int i = start; i < end; i++) {
+        result.append(toMessage(records.at(i)));
+    }
+    return result;
+}
+
+QVector<Message> RoomLog::getMessagesAfter(quint64 afterSeq) const {
+    QVector<Message> result;
+
+    int lo = 0;
+    int hi = records.size();
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (records.at(mid).seq <= afterSeq) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    result.reserve(records.size() - lo);
+    for (int i = lo; i < records.size(); i++) {
+        result.append(toMessage(records.at(i)));
+    }
+    return result;
+}
+
+quint64 RoomLog::append(const Message& msg) {
+    // Stamp the next sequence number and add to the end of the log
+    MessageRecord record = makeRecord(msg);
+    if (record.seq <= lastSeq) {
+        record.seq = lastSeq + 1;
+    }
+    lastSeq = record.seq;
+    records.append(record);
+    ++version;
+    return lastSeq;
+}
+
+bool RoomLog::updateContent(quint64 seq, const QString& content) {
+    int index = indexOfSeq(seq);
+    if (index < 0) {
+        return false;
+    }
+
+    // The arena is append-only: the edited text goes at the end and the old
+    // bytes are dropped the next time the room is loaded
+    QByteArray text = content.toUtf8();
+    MessageRecord &record = records[index];
+    record.textOffset = quint32(arena.size());
+    record.textLength = quint32(text.size());
+    arena.append(text);
+    ++version;
+    return true;
+}
+
+void RoomLog::removeAt(int index) {
+    if (index >= 0 && index < records.size()) {
+        records.removeAt(index);
+        ++version;
+    }
+}
+
+void RoomLog::replaceAll(const QVector<Message>& msgs) {
+    clear();
+    records.reserve(msgs.size());
+    for (const Message &msg : msgs) {
+        records.append(makeRecord(msg));
+    }
+    renumberFrom(0);
+    loaded = true;
+    ++version;
+}
+
+void RoomLog::clear() {
+    records.clear();
+    arena.clear();
+    lastSeq = 0;
+    ++version;
+}
+
+void RoomLog::load() {
+    clear(); // Clear existing messages to avoid duplicates
+    loaded = true;
+
+    // Let queued appends for this room reach the file first
+    RoomLogStore::getInstance()->waitForFile(roomId);
+
+    // Room IDs are canonical, so the file name is exact
+    QString roomFile = "../db/rooms/" + roomId + ".txt";
+    QFile file(roomFile);
+
+    if (file.open(QIODevice::ReadOnly | QIODevice::Text)) {
+        QTextStream in(&file);
+
+        while (!in.atEnd()) {
+            QString line = in.readLine().trimmed();
+            if (!line.isEmpty()) {
+                records.append(makeRecord(Message::fromString(line)));
+            }
+        }
+        file.close();
+        renumberFrom(0);
+
+        qDebug() << "Loaded" << records.size() << "messages for room" << roomId;
+    } else {
+        qDebug() << "Failed to open room file for reading:" << roomFile << file.errorString();
+    }
+
+    // Freshly read from disk, so nothing to write back. Legacy lines without
+    // sequence numbers are renumbered the same way on every load.
+    savedVersion = version;
+}
+
+void RoomLog::save() {
+    // A rewrite must not race an append still queued for this room
+    RoomLogStore::getInstance()->waitForFile(roomId);
+
+    QString roomFile = "../db/rooms/" + roomId + ".txt";
+
+    // Create the rooms directory if it doesn't exist
+    QDir dir("../db/rooms");
+    if (!dir.exists()) {
+        dir.mkpath(".");
+    }
+
+    QFile file(roomFile);
+    if (file.open(QIODevice::WriteOnly | QIODevice::Text)) {
+        QTextStream out(&file);
+
+        // The log is already in chronological order
+        for (const MessageRecord& record : records) {
+            out << toMessage(record).toString() << "\n";
+        }
+
+        file.close();
+        savedVersion = version;
+        qDebug() << "Saved" << records.size() << "messages for room" << roomId;
+    } else {
+        qDebug() << "Failed to save messages for room" << roomId << ":" << file.errorString();
+    }
+}
+
+bool RoomLog::saveIfDirty() {
+    if (!isDirty()) {
+        return false;
+    }
+    save();
+    return true;
+}
+
+void RoomLog::appendToFile(const Message& msg) {
+    quint64 appendedVersion = version;
+    if (appendLine(roomId, msg.toString())) {
+        markAppended(appendedVersion);
+    }
+}
+
+bool RoomLog::appendLine(const QString& roomId, const QString& line) {
+    QFile file("../db/rooms/" + roomId + ".txt");
+    if (file.open(QIODevice::WriteOnly | QIODevice::Append | QIODevice::Text)) {
+        QTextStream out(&file);
+        out << line << "\n";
+        file.close();
+        return true;
+    }
+    qDebug() << "Failed to append message to room" << roomId << ":" << file.errorString();
+    return false;
+}
+
+void RoomLog::markAppended(quint64 appendedVersion) {
+    // If the file was current just before that append, it is current up to
+    // it now. Appends complete in order, so a run of them each moves this
+    // on by one; a failed one leaves the log dirty for the next save.
+    if (savedVersion + 1 == appendedVersion) {
+        savedVersion = appendedVersion;
+    }
+}
+
+bool RoomLog::readTail(const QString& roomId, Message& last) {
+    RoomLogStore::getInstance()->waitForFile(roomId);
+
+    QFile file("../db/rooms/" + roomId + ".txt");
+    if (!file.open(QIODevice::ReadOnly)) {
+        return false;
+    }
+
+    // Read backwards in growing blocks until a whole last line is in hand
+    qint64 size = file.size();
+    qint64 block = 4096;
+    QByteArray line;
+    while (true) {
+        qint64 start = qMax<qint64>(0, size - block);
+        file.seek(start);
+        QByteArray tail = file.read(size - start).trimmed();
+        int newline = tail.lastIndexOf('\n');
+        if (newline >= 0 || start == 0) {
+            line = tail.mid(newline + 1).trimmed();
+            break;
+        }
+        block *= 4;
+    }
+    if (line.isEmpty()) {
+        file.close();
+        return false;
+    }
+
+    Message msg = Message::fromString(QString::fromUtf8(line));
+    quint64 seq = msg.getSeq();
+    if (seq == 0) {
+        // Legacy file: load numbers its lines in order, so count them
+        file.seek(0);
+        while (!file.atEnd()) {
+            if (!file.readLine().trimmed().isEmpty()) {
+                ++seq;
+            }
+        }
+    }
+    file.close();
+
+    // Same normalization as makeRecord
+    last = Message(msg.getContent(), msg.getSender().trimmed().toLower(),
+                   msg.getTimestamp(), msg.getReadStatus(), seq);
+    return true;
+}
+
+qint64 RoomLog::residentBytes() const {
+    qint64 bytes = sizeof(RoomLog) + roomId.capacity() * qint64(sizeof(QChar));
+    if (loaded) {
+        bytes += records.capacity() * qint64(sizeof(MessageRecord)) + arena.capacity();
+    }
+    return bytes;
+}
+
+bool RoomLog::unload() {
+    if (!loaded) {
+        return false;
+    }
+    saveIfDirty();
+
+    // Swap with empty containers so the memory is actually released.
+    // lastSeq stays, so sequence numbers keep working while unloaded.
+    QVector<MessageRecord>().swap(records);
+    QByteArray().swap(arena);
+    loaded = false;
+    return true;
+}
+
+RoomLogStore* RoomLogStore::instance = nullptr;
+
+RoomLogStore* RoomLogStore::getInstance() {
+    if (instance == nullptr) {
+        instance = new RoomLogStore();
+    }
+    return instance;
+}
+
+RoomLogPtr RoomLogStore::acquire(const QString& roomId) {
+    auto it = logs.constFind(roomId);
+    if (it != logs.constEnd()) {
+        it.value()->ensureLoaded();
+        it.value()->touch();
+        return it.value();
+    }
+
+    RoomLogPtr log(new RoomLog(roomId));
+    log->load();
+    logs.insert(roomId, log);
+    clockRing.append(log);
+    return log;
+}
+
+void RoomLogStore::remove(const QString& roomId) {
+    RoomLogPtr log = logs.take(roomId);
+    int index = clockRing.indexOf(log);
+    if (index >= 0) {
+        clockRing.removeAt(index);
+        if (clockHand > index) {
+            --clockHand;
+        }
+    }
+}
+
+qint64 RoomLogStore::residentBytes(int *loadedCount) const {
+    qint64 bytes = 0;
+    int loadedLogs = 0;
+    for (const RoomLogPtr &log : clockRing) {
+        bytes += log->residentBytes();
+        if (log->isLoaded()) {
+            ++loadedLogs;
+        }
+    }
+    if (loadedCount) {
+        *loadedCount = loadedLogs;
+    }
+    return bytes;
+}
+
+int RoomLogStore::evictToBudget(qint64 budgetBytes) {
+    qint64 resident = residentBytes();
+    int evicted = 0;
+
+    // CLOCK: a used log gets a second chance, an unused one is spilled. Two
+    // full sweeps are enough to clear every reference bit once.
+    for (int steps = 0; resident > budgetBytes && steps < 2 * clockRing.size(); ++steps) {
+        if (clockHand >= clockRing.size()) {
+            clockHand = 0;
+        }
+        RoomLog *log = clockRing[clockHand].data();
+        clockHand++;
+
+        if (!log->isLoaded()) {
+            continue;
+        }
+        if (log->referenced) {
+            log->referenced = false;
+            continue;
+        }
+
+        qint64 before = log->residentBytes();
+        if (log->unload()) {
+            resident -= before - log->residentBytes();
+            ++evicted;
+        }
+    }
+    return evicted;
+}
@@ -0,0 +1,150 @@
+#ifndef ROOMLOG_H
+#define ROOMLOG_H
+
+#include <QString>
+#include <QVector>
+#include <QHash>
+#include <QList>
+#include <QSharedPointer>
+#include <QByteArray>
+#include <functional>
+#include "message.h"
+#include "userids.h"
+
+// Compact, trivially relocatable form of a stored message. The text lives in
+// the owning log's UTF-8 arena; Message objects are only built for callers.
+struct MessageRecord {
+    enum Flag : quint32 {
+        ReadFlag = 0x1,             // Legacy per-message read bit
+        InvalidTimestampFlag = 0x2  // Timestamp did not parse
+    };
+
+    qint64 timestampMs;  // Milliseconds since the epoch
+    quint64 seq;         // Per-room sequence number
+    quint32 textOffset;  // Byte offset of the content in the arena
+    quint32 textLength;  // Byte length of the content
+    UserHandle sender;   // Interned sender ID
+    quint32 flags;       // Flag bits
+};
+Q_DECLARE_TYPEINFO(MessageRecord, Q_PRIMITIVE_TYPE);
+
+// The one in-memory copy of a room's history. Every Room object for the same
+// conversation (the sender's, the recipient's, the server's) shares it, so a
+// message is stored once and appending is O(1).
+class RoomLog {
+private:
+    QString roomId;
+    QVector<MessageRecord> records; // Sorted by sequence number, append-only
+    QByteArray arena;               // UTF-8 text of every record, back to back
+    quint64 lastSeq;           // Highest sequence number handed out
+    bool loaded;               // Whether the room file has been read yet
+    quint64 version;           // Bumped on every change
+    quint64 savedVersion;      // Version the room file reflects
+    bool referenced;           // CLOCK reference bit, set on every use
+
+    friend class RoomLogStore;
+
+public:
+    explicit RoomLog(const QString& roomId);
+
+    QString getRoomId() const { return roomId; }
+    // Raw records, for scans that do not need the text
+    const QVector<MessageRecord>& getRecords() const { return records; }
+    int size() const { return records.size(); }
+    bool isEmpty() const { return records.isEmpty(); }
+
+    // Materialized messages (builds QStrings; meant for the UI edge)
+    Message at(int index) const { return toMessage(records.at(index)); }
+    QVector<Message> getMessages() const;
+    QString textOf(const MessageRecord& record) const {
+        return QString::fromUtf8(arena.constData() + record.textOffset, int(record.textLength));
+    }
+    Message toMessage(const MessageRecord& record) const;
+    quint64 getLastSeq() const { return lastSeq; }
+    bool isLoaded() const { return loaded; }
+    bool isDirty() const { return version != savedVersion; }
+    quint64 getVersion() const { return version; }
+
+    // Memory accounting and eviction
+    void touch() { referenced = true; }
+    qint64 residentBytes() const;
+    bool unload(); // Drop records and text (saving first if dirty); reloaded on next use
+
+    // Sequence-number lookups
+    int indexOfSeq(quint64 seq) const;
+    QVector<Message> getMessagesBefore(quint64 beforeSeq, int limit) const;
+    QVector<Message> getMessagesAfter(quint64 afterSeq) const;
+
+    // Mutation
+    quint64 append(const Message& msg); // Returns the assigned sequence number
+    bool updateContent(quint64 seq, const QString& content);
+    void removeAt(int index);
+    void replaceAll(const QVector<Message>& msgs);
+    void reserve(int count) { records.reserve(count); }
+    void clear();
+
+    // Persistence
+    void load();                          // Read the whole room file
+    void ensureLoaded() { if (!loaded) load(); }
+    void save();                          // Rewrite the whole room file
+    bool saveIfDirty();                   // Rewrite only if something changed
+    void appendToFile(const Message& msg); // Append one line for the newest message
+    // appendToFile in two halves, for callers that write the line elsewhere:
+    // the file write itself (any thread) and, only once it has succeeded,
+    // the bookkeeping (owner only) for the version the append produced
+    static bool appendLine(const QString& roomId, const QString& line);
+    void markAppended(quint64 appendedVersion);
+    // The newest message in a room file, read from its end without loading
+    // the log. False if the room has no messages.
+    static bool readTail(const QString& roomId, Message& last);
+
+private:
+    MessageRecord makeRecord(const Message& msg); // Copies the text into the arena
+    void renumberFrom(int index);                 // Fill gaps left by legacy lines
+};
+
+typedef QSharedPointer<RoomLog> RoomLogPtr;
+
+// Process-wide registry of room logs, keyed by room ID. Rooms look their log
+// up here, so every view of a conversation ends up on the same instance.
+class RoomLogStore {
+private:
+    RoomLogStore() : clockHand(0) {}
+    RoomLogStore(const RoomLogStore&) = delete;
+    RoomLogStore& operator=(const RoomLogStore&) = delete;
+
+    static RoomLogStore* instance;
+
+    QHash<QString, RoomLogPtr> logs;
+    QVector<RoomLogPtr> clockRing; // Every log, in CLOCK sweep order
+    int clockHand;
+    std::function<void(const QString&)> fileBarrier;
+
+public:
+    static RoomLogStore* getInstance();
+
+    // The shared log for a room, created on first use and loaded (again, if
+    // it was evicted) so it is ready to read
+    RoomLogPtr acquire(const QString& roomId);
+    // The shared log for a room, or null if nobody has opened it
+    RoomLogPtr find(const QString& roomId) const { return logs.value(roomId); }
+    void remove(const QString& roomId);
+    QList<RoomLogPtr> allLogs() const { return logs.values(); }
+
+    // Bytes held by loaded logs, and how many are loaded
+    qint64 residentBytes(int *loadedCount = nullptr) const;
+    // Unload cold logs (CLOCK order) until at most budgetBytes remain resident.
+    // Returns the number of logs unloaded.
+    int evictToBudget(qint64 budgetBytes);
+
+    // Hook run before a room file is read or rewritten, so writes queued on
+    // other threads for that room land first
+    void setFileBarrier(std::function<void(const QString&)> barrier) { fileBarrier = barrier; }
+    void waitForFile(const QString& roomId) const {
+        if (fileBarrier) {
+            fileBarrier(roomId);
+        }
+    }
+};
+
+#endif // ROOMLOG_H
@@ -0,0 +1,42 @@
+#include "userids.h"
+#include "room.h"
+
+UserIds* UserIds::instance = nullptr;
+
+UserIds* UserIds::getInstance() {
+    if (instance == nullptr) {
+        instance = new UserIds();
+    }
+    return instance;
+}
+
+UserHandle UserIds::intern(const QString& userId) {
+    auto it = handles.constFind(userId);
+    if (it != handles.constEnd()) {
+        return it.value();
+    }
+
+    ids.append(userId);
+    UserHandle handle = UserHandle(ids.size());
+    handles.insert(userId, handle);
+    return handle;
+}
+
+RoomKey UserIds::roomKeyForRoomId(const QString& roomId) {
+    QString userA, userB;
+    if (!Room::splitRoomId(roomId, userA, userB)) {
+        return 0;
+    }
+    // Room IDs come from disk and may predate ID normalization
+    return roomKeyFor(userA.trimmed().toLower(), userB.trimmed().toLower());
+}
+
+RoomKey UserIds::findRoomKeyForRoomId(const QString& roomId) const {
+    QString userA, userB;
+    if (!Room::splitRoomId(roomId, userA, userB)) {
+        return 0;
+    }
+    UserHandle a = find(userA.trimmed().toLower());
+    UserHandle b = find(userB.trimmed().toLower());
+    return a != 0 && b != 0 ? roomKey(a, b) : 0;
+}
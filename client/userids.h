@@ -0,0 +1,64 @@
+#ifndef USERIDS_H
+#define USERIDS_H
+
+#include <QString>
+#include <QHash>
+#include <QVector>
+#include <QtGlobal>
+
+// Dense integer handle for a user; 0 means "no such user"
+typedef quint32 UserHandle;
+
+// Key for a two-person room: both participants' handles packed into one
+// integer, smaller handle in the high half so the key is order-independent
+typedef quint64 RoomKey;
+
+// Interns user IDs (canonical emails) into dense integer handles so the core
+// can key its maps on integers. Strings are only needed at the API/UI boundary.
+class UserIds {
+private:
+    UserIds() {}
+    UserIds(const UserIds&) = delete;
+    UserIds& operator=(const UserIds&) = delete;
+
+    static UserIds* instance;
+
+    QHash<QString, UserHandle> handles; // UserId -> handle
+    QVector<QString> ids;               // handle - 1 -> UserId
+
+public:
+    static UserIds* getInstance();
+
+    // Handle for a user ID, assigning the next one if it is new
+    UserHandle intern(const QString& userId);
+    // Handle for a user ID, or 0 if it has never been interned
+    UserHandle find(const QString& userId) const { return handles.value(userId, 0); }
+    // The user ID behind a handle, or an empty string for an unknown handle
+    QString idOf(UserHandle handle) const {
+        return handle > 0 && int(handle) <= ids.size() ? ids.at(int(handle) - 1) : QString();
+    }
+    int size() const { return ids.size(); }
+
+    // Room key helpers
+    static RoomKey roomKey(UserHandle a, UserHandle b) {
+        if (a > b) {
+            qSwap(a, b);
+        }
+        return (RoomKey(a) << 32) | RoomKey(b);
+    }
+    static UserHandle firstOf(RoomKey key) { return UserHandle(key >> 32); }
+    static UserHandle secondOf(RoomKey key) { return UserHandle(key & 0xFFFFFFFFu); }
+
+    // Key for the room between two user IDs (interning both)
+    RoomKey roomKeyFor(const QString& userA, const QString& userB) {
+        return roomKey(intern(userA), intern(userB));
+    }
+    // Key for a "userA_userB" room ID, or 0 if it does not name two users.
+    // The participants are normalized first, so legacy mixed-case IDs match.
+    RoomKey roomKeyForRoomId(const QString& roomId);
+    // Same, but never interns: 0 unless both participants are already known.
+    // Use this for lookups so probing unknown IDs cannot grow the table.
+    RoomKey findRoomKeyForRoomId(const QString& roomId) const;
+};
+
+#endif // USERIDS_H
@@ -29,6 +29,8 @@
 #include <QDebug>
 #include <QCheckBox>
 #include <QTimer>
+#include <QHash>
+#include <QSet>
 #include <QApplication>
 #include <QDialog>
 #include <QFileDialog>
@@ -76,6 +78,7 @@ struct MessageInfo {
     bool isFromMe;
     QDateTime timestamp;
     QString sender;    // Add sender field for group messages
+    quint64 seq = 0;   // Room sequence number (0 for group messages)
 };
 
 // Story Structure
@@ -121,8 +124,15 @@ private slots:
     void changePassword(); // Method to handle password changes
     void onlineStatusChanged(int state); // Handle online/offline toggle
     void refreshOnlineStatus(); // Periodically refresh online status of users
+    void updatePresenceSubscriptions(); // Subscribe to contacts and visible rows only
+    void loadDirectoryPage(); // Append the next page of the user directory
+    int addDirectoryUser(const QString &email, const QString &nickname); // Index in userList, or -1
     void updateUsersList();
     void filterUsers();
+    // Show, hide or add only the user rows whose match status changed
+    void applySearchFilter(bool wasSearching, const QSet<QString> &previousMatches,
+                           const QHash<QString, int> &matchIndexes);
+    bool userRowVisible(const UserInfo &user) const;
     void handleUserSelected(int row);
     void sendMessage();
     void changeAvatar(); // Method to handle avatar change request
@@ -158,6 +168,7 @@ private slots:
     // Message read status methods
     void markMessagesAsRead(int userIndex); // Mark messages from other user as read
     void updateReadReceipts(); // Update read receipt indicators in UI
+    UiTask loadOlderMessages(); // Prepend the previous page of the open chat
 
 private:
     // UI Elements
@@ -193,6 +204,7 @@ private:
     
     // Timer for refreshing online status
     QTimer *onlineStatusTimer;
+    QTimer *presenceSubscriptionTimer; // Coalesces interest-list updates while scrolling
     QTimer *storiesTimer; // Timer for refreshing stories
 
     // Data
@@ -200,6 +212,11 @@ private:
     QVector<QVector<MessageInfo>> userMessages;
     int currentUserId;
     bool isSearching;  // Flag to indicate if we're in search mode
+    QSet<QString> searchMatches; // Emails the server's directory search returned
+    QHash<QString, QListWidgetItem *> userRows; // Email -> its row, until the list is rebuilt
+    QTimer *searchDebounceTimer; // Runs the search once typing pauses
+    bool browsingDirectory;      // No contacts or chats yet: listing the directory
+    QString directoryCursor;     // Where the next directory page starts; empty when done
     UserSettings userSettings; // Store user settings
 
     // Blocked users UI elements
@@ -211,13 +228,23 @@ private:
     int currentGroupId;
     bool isInGroupChat;
 
+    // Recipient read watermark already reflected by the open chat's receipts
+    quint64 shownReadWatermark;
+
+    // Whether the open chat's header currently says the peer is typing
+    bool peerTyping;
+
+    // An older page is on its way; further scroll-to-top events wait for it
+    bool loadingOlderMessages;
+
     // Setup methods
     void createNavigationPanel(QHBoxLayout *mainLayout);
     void createUsersPanel(QHBoxLayout *mainLayout);
     void createChatArea(QHBoxLayout *mainLayout);
     void updateChatArea(int userId);
     void updateGroupChatArea(int groupId); // Add method declaration for group chat area update
-    void addMessageToUI(const QString &text, bool isFromMe, const QDateTime &timestamp);
+    void addMessageToUI(const QString &text, bool isFromMe, const QDateTime &timestamp,
+                        quint64 seq = 0, bool prepend = false);
     bool eventFilter(QObject *obj, QEvent *event) override;
     void loadMessagesForCurrentUser();
     void loadUserSettings(); // Load user settings from storage
@@ -0,0 +1,88 @@
+// ephemeral.cpp
+#include "ephemeral.h"
+
+EphemeralChannel::EphemeralChannel(qint64 throttleMs, qint64 ttlMs)
+    : throttleMs(throttleMs), ttlMs(ttlMs) {}
+
+bool EphemeralChannel::publish(quint64 topic, UserHandle user, qint64 nowMs) {
+    if (user == 0) {
+        return false;
+    }
+
+    QVector<Signal> &entries = topics[topic];
+    for (Signal &signal : entries) {
+        if (signal.user != user) {
+            continue;
+        }
+        // Still live and inside the window: drop the event
+        if (signal.deadlineMs > nowMs && nowMs - signal.lastEventMs < throttleMs) {
+            return false;
+        }
+        signal.lastEventMs = nowMs;
+        signal.deadlineMs = nowMs + ttlMs;
+        return true;
+    }
+
+    entries.append(Signal{user, nowMs, nowMs + ttlMs});
+    return true;
+}
+
+void EphemeralChannel::clear(quint64 topic, UserHandle user) {
+    auto it = topics.find(topic);
+    if (it == topics.end()) {
+        return;
+    }
+    QVector<Signal> &entries = it.value();
+    for (int i = 0; i < entries.size(); ++i) {
+        if (entries[i].user == user) {
+            entries.remove(i);
+            break;
+        }
+    }
+    if (entries.isEmpty()) {
+        topics.erase(it);
+    }
+}
+
+bool EphemeralChannel::isActive(quint64 topic, UserHandle user, qint64 nowMs) const {
+    auto it = topics.constFind(topic);
+    if (it == topics.constEnd()) {
+        return false;
+    }
+    for (const Signal &signal : it.value()) {
+        if (signal.user == user) {
+            return signal.deadlineMs > nowMs;
+        }
+    }
+    return false;
+}
+
+QVector<UserHandle> EphemeralChannel::active(quint64 topic, qint64 nowMs) const {
+    QVector<UserHandle> result;
+    auto it = topics.constFind(topic);
+    if (it == topics.constEnd()) {
+        return result;
+    }
+    for (const Signal &signal : it.value()) {
+        if (signal.deadlineMs > nowMs) {
+            result.append(signal.user);
+        }
+    }
+    return result;
+}
+
+void EphemeralChannel::sweep(qint64 nowMs) {
+    for (auto it = topics.begin(); it != topics.end();) {
+        QVector<Signal> &entries = it.value();
+        for (int i = entries.size() - 1; i >= 0; --i) {
+            if (entries[i].deadlineMs <= nowMs) {
+                entries.remove(i);
+            }
+        }
+        if (entries.isEmpty()) {
+            it = topics.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
@@ -0,0 +1,43 @@
+// ephemeral.h
+#ifndef EPHEMERAL_H
+#define EPHEMERAL_H
+
+#include <QHash>
+#include <QVector>
+#include <QtGlobal>
+#include "../client/userids.h"
+
+// Short-lived per-user signals scoped to a topic (typing in a room, "is
+// recording", and the like). Everything lives in memory and expires on its
+// own; nothing here is ever written under db/. Each user may publish at most
+// one event per topic per throttle window, so callers can forward raw UI
+// events without rate limiting them first.
+class EphemeralChannel {
+public:
+    EphemeralChannel(qint64 throttleMs, qint64 ttlMs);
+
+    // Returns false if the event was dropped by the throttle
+    bool publish(quint64 topic, UserHandle user, qint64 nowMs);
+    // The user stopped (sent the message, cleared the input)
+    void clear(quint64 topic, UserHandle user);
+
+    bool isActive(quint64 topic, UserHandle user, qint64 nowMs) const;
+    QVector<UserHandle> active(quint64 topic, qint64 nowMs) const;
+
+    // Drop expired state; reads already ignore it, this just frees memory
+    void sweep(qint64 nowMs);
+    int topicCount() const { return topics.size(); }
+
+private:
+    struct Signal {
+        UserHandle user;
+        qint64 lastEventMs; // Last event that got through the throttle
+        qint64 deadlineMs;  // Active until this time
+    };
+
+    QHash<quint64, QVector<Signal>> topics; // A topic rarely has more than a few users
+    qint64 throttleMs;
+    qint64 ttlMs;
+};
+
+#endif // EPHEMERAL_H
@@ -0,0 +1,223 @@
+// handleset.cpp
+#include "handleset.h"
+#include <QtAlgorithms>
+#include <algorithm>
+
+bool HandleSet::containerHas(const Container &container, quint16 low) {
+    if (!container.bits.isEmpty()) {
+        return (container.bits[low >> 6] >> (low & 63)) & 1;
+    }
+    return std::binary_search(container.array.constBegin(), container.array.constEnd(), low);
+}
+
+int HandleSet::containerRank(const Container &container, quint16 low) {
+    if (!container.bits.isEmpty()) {
+        int rank = 0;
+        for (int w = 0; w < (low >> 6); ++w) {
+            rank += int(qPopulationCount(container.bits[w]));
+        }
+        quint64 below = (quint64(1) << (low & 63)) - 1;
+        return rank + int(qPopulationCount(container.bits[low >> 6] & below));
+    }
+    return int(std::lower_bound(container.array.constBegin(), container.array.constEnd(), low) -
+               container.array.constBegin());
+}
+
+bool HandleSet::containerInsert(Container &container, quint16 low) {
+    if (!container.bits.isEmpty()) {
+        quint64 &word = container.bits[low >> 6];
+        quint64 bit = quint64(1) << (low & 63);
+        if (word & bit) {
+            return false;
+        }
+        word |= bit;
+        ++container.count;
+        return true;
+    }
+
+    auto it = std::lower_bound(container.array.begin(), container.array.end(), low);
+    if (it != container.array.end() && *it == low) {
+        return false;
+    }
+    container.array.insert(it, low);
+    ++container.count;
+
+    // Dense group: a fixed 8 KB bitmap beats a longer array
+    if (container.count > ARRAY_MAX) {
+        container.bits = QVector<quint64>(BITMAP_WORDS, 0);
+        for (quint16 value : container.array) {
+            container.bits[value >> 6] |= quint64(1) << (value & 63);
+        }
+        container.array = QVector<quint16>();
+    }
+    return true;
+}
+
+bool HandleSet::containerRemove(Container &container, quint16 low) {
+    if (!container.bits.isEmpty()) {
+        quint64 &word = container.bits[low >> 6];
+        quint64 bit = quint64(1) << (low & 63);
+        if (!(word & bit)) {
+            return false;
+        }
+        word &= ~bit;
+        --container.count;
+
+        // Back to an array once the group has thinned out well below the limit
+        if (container.count < ARRAY_MAX / 2) {
+            QVector<quint16> array;
+            array.reserve(container.count);
+            for (int w = 0; w < BITMAP_WORDS; ++w) {
+                for (quint64 bits = container.bits[w]; bits; bits &= bits - 1) {
+                    array.append(quint16(w * 64 + int(qCountTrailingZeroBits(bits))));
+                }
+            }
+            container.array = array;
+            container.bits = QVector<quint64>();
+        }
+        return true;
+    }
+
+    auto it = std::lower_bound(container.array.begin(), container.array.end(), low);
+    if (it == container.array.end() || *it != low) {
+        return false;
+    }
+    container.array.erase(it);
+    --container.count;
+    return true;
+}
+
+bool HandleSet::contains(UserHandle handle) const {
+    if (!roaring) {
+        return small.contains(handle);
+    }
+    auto it = containers.constFind(quint16(handle >> 16));
+    return it != containers.constEnd() && containerHas(it.value(), quint16(handle & 0xFFFF));
+}
+
+bool HandleSet::insert(UserHandle handle) {
+    if (!roaring) {
+        if (small.contains(handle)) {
+            return false;
+        }
+        small.insert(handle);
+        ++count;
+        if (count > PROMOTE_AT) {
+            promote();
+        }
+        return true;
+    }
+
+    if (!containerInsert(containers[quint16(handle >> 16)], quint16(handle & 0xFFFF))) {
+        return false;
+    }
+    ++count;
+    return true;
+}
+
+bool HandleSet::remove(UserHandle handle) {
+    if (!roaring) {
+        if (!small.remove(handle)) {
+            return false;
+        }
+        --count;
+        return true;
+    }
+
+    auto it = containers.find(quint16(handle >> 16));
+    if (it == containers.end() || !containerRemove(it.value(), quint16(handle & 0xFFFF))) {
+        return false;
+    }
+    if (it.value().count == 0) {
+        containers.erase(it);
+    }
+    --count;
+    if (count < DEMOTE_AT) {
+        demote();
+    }
+    return true;
+}
+
+void HandleSet::promote() {
+    const QSet<UserHandle> members = small;
+    small.clear();
+    roaring = true;
+    for (UserHandle handle : members) {
+        containerInsert(containers[quint16(handle >> 16)], quint16(handle & 0xFFFF));
+    }
+}
+
+void HandleSet::demote() {
+    const QVector<UserHandle> members = toVector();
+    containers.clear();
+    roaring = false;
+    small.reserve(members.size());
+    for (UserHandle handle : members) {
+        small.insert(handle);
+    }
+}
+
+int HandleSet::rank(UserHandle handle) const {
+    int rank = 0;
+    if (!roaring) {
+        for (UserHandle member : small) {
+            rank += member < handle ? 1 : 0;
+        }
+        return rank;
+    }
+
+    // Few containers (one per 65536 handles), so summing them is cheap
+    quint16 high = quint16(handle >> 16);
+    for (auto it = containers.constBegin(); it != containers.constEnd(); ++it) {
+        if (it.key() < high) {
+            rank += it.value().count;
+        } else if (it.key() == high) {
+            rank += containerRank(it.value(), quint16(handle & 0xFFFF));
+        }
+    }
+    return rank;
+}
+
+QVector<UserHandle> HandleSet::toVector() const {
+    QVector<UserHandle> result;
+    result.reserve(count);
+    if (!roaring) {
+        for (UserHandle handle : small) {
+            result.append(handle);
+        }
+        std::sort(result.begin(), result.end());
+        return result;
+    }
+
+    QVector<quint16> highs = containers.keys().toVector();
+    std::sort(highs.begin(), highs.end());
+    for (quint16 high : highs) {
+        const Container &container = containers[high];
+        UserHandle base = UserHandle(high) << 16;
+        if (container.bits.isEmpty()) {
+            for (quint16 low : container.array) {
+                result.append(base | low);
+            }
+            continue;
+        }
+        for (int w = 0; w < BITMAP_WORDS; ++w) {
+            for (quint64 bits = container.bits[w]; bits; bits &= bits - 1) {
+                result.append(base | UserHandle(w * 64 + int(qCountTrailingZeroBits(bits))));
+            }
+        }
+    }
+    return result;
+}
+
+qint64 HandleSet::residentBytes() const {
+    if (!roaring) {
+        // Node plus bucket pointer per member
+        return small.size() * qint64(sizeof(UserHandle) + 2 * sizeof(void *));
+    }
+    qint64 bytes = 0;
+    for (const Container &container : containers) {
+        bytes += sizeof(Container) + container.array.capacity() * qint64(sizeof(quint16)) +
+                 container.bits.capacity() * qint64(sizeof(quint64));
+    }
+    return bytes;
+}
@@ -0,0 +1,54 @@
+// handleset.h
+#ifndef HANDLESET_H
+#define HANDLESET_H
+
+#include <QHash>
+#include <QSet>
+#include <QVector>
+#include <QtGlobal>
+#include "../client/userids.h"
+
+// Set of user handles that adapts to its size. Small sets (almost every
+// contact or block list) are plain hash sets. Past PROMOTE_AT members the
+// set becomes a roaring bitmap: handles grouped by their high 16 bits, each
+// group a sorted array of low halves, or a 64 Kbit bitmap once the group is
+// dense. Lookups are a hash probe either way, plus a bit test or a short
+// binary search.
+class HandleSet {
+public:
+    static const int PROMOTE_AT = 256; // Hash set -> roaring above this
+    static const int DEMOTE_AT = 128;  // Roaring -> hash set below this
+
+    bool contains(UserHandle handle) const;
+    bool insert(UserHandle handle); // False if already present
+    bool remove(UserHandle handle); // False if absent
+    int size() const { return count; }
+    bool isEmpty() const { return count == 0; }
+    int rank(UserHandle handle) const;    // Members smaller than handle
+    QVector<UserHandle> toVector() const; // Ascending
+    qint64 residentBytes() const;
+
+private:
+    static const int ARRAY_MAX = 4096;  // Array container -> bitmap above this
+    static const int BITMAP_WORDS = 1024;
+
+    struct Container {
+        QVector<quint16> array; // Sorted low halves while sparse
+        QVector<quint64> bits;  // BITMAP_WORDS words once dense
+        int count = 0;
+    };
+
+    QSet<UserHandle> small;
+    QHash<quint16, Container> containers; // High half -> container
+    bool roaring = false;
+    int count = 0;
+
+    static bool containerHas(const Container &container, quint16 low);
+    static int containerRank(const Container &container, quint16 low);
+    static bool containerInsert(Container &container, quint16 low);
+    static bool containerRemove(Container &container, quint16 low);
+    void promote();
+    void demote();
+};
+
+#endif // HANDLESET_H
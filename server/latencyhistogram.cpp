@@ -0,0 +1,74 @@
+// latencyhistogram.cpp
+#include "latencyhistogram.h"
+#include <QtAlgorithms>
+#include <cmath>
+
+int LatencyHistogram::bucketOf(quint64 nanoseconds) {
+    if (nanoseconds < 4) {
+        return int(nanoseconds);
+    }
+    // Two bits below the leading one pick the quarter of the power of two
+    int exponent = 63 - int(qCountLeadingZeroBits(nanoseconds));
+    int quarter = int((nanoseconds >> (exponent - 2)) & 3);
+    return 4 * (exponent - 1) + quarter;
+}
+
+quint64 LatencyHistogram::upperBoundOf(int bucket) {
+    if (bucket < 4) {
+        return quint64(bucket);
+    }
+    int exponent = bucket / 4 + 1;
+    int quarter = bucket % 4;
+    quint64 width = quint64(1) << (exponent - 2);
+    return (quint64(4 + quarter) << (exponent - 2)) + width - 1;
+}
+
+void LatencyHistogram::record(qint64 nanoseconds) {
+    if (nanoseconds < 0) {
+        nanoseconds = 0;
+    }
+    ++counts[bucketOf(quint64(nanoseconds))];
+    ++total;
+    sumNs += quint64(nanoseconds);
+    if (nanoseconds > maxNs) {
+        maxNs = nanoseconds;
+    }
+}
+
+void LatencyHistogram::clear() {
+    for (quint64 &count : counts) {
+        count = 0;
+    }
+    total = 0;
+    sumNs = 0;
+    maxNs = 0;
+}
+
+qint64 LatencyHistogram::percentile(double q) const {
+    if (total == 0) {
+        return 0;
+    }
+    quint64 rank = quint64(std::ceil(qBound(0.0, q, 1.0) * double(total)));
+    if (rank == 0) {
+        rank = 1;
+    }
+    quint64 seen = 0;
+    for (int bucket = 0; bucket < BUCKETS; ++bucket) {
+        seen += counts[bucket];
+        if (seen >= rank) {
+            // The bucket bound can overshoot the largest value recorded
+            return qMin(qint64(upperBoundOf(bucket)), maxNs);
+        }
+    }
+    return maxNs;
+}
+
+QString LatencyHistogram::summary() const {
+    auto us = [](qint64 ns) { return QString::number(double(ns) / 1000.0, 'f', 1); };
+    return QString("n=%1, p50=%2us, p90=%3us, p99=%4us, max=%5us")
+        .arg(total)
+        .arg(us(percentile(0.50)))
+        .arg(us(percentile(0.90)))
+        .arg(us(percentile(0.99)))
+        .arg(us(maxNs));
+}
@@ -0,0 +1,40 @@
+// latencyhistogram.h
+#ifndef LATENCYHISTOGRAM_H
+#define LATENCYHISTOGRAM_H
+
+#include <QString>
+#include <QtGlobal>
+
+// Fixed-size log-linear histogram of durations in nanoseconds. Each power of
+// two is split into four buckets, so any reported percentile is within 25%
+// of the true value, from nanoseconds up to centuries, in 2 KB and with O(1)
+// recording. Not thread-safe: record from one thread.
+class LatencyHistogram {
+public:
+    static const int BUCKETS = 256;
+
+    LatencyHistogram() { clear(); }
+
+    void record(qint64 nanoseconds);
+    void clear();
+
+    quint64 count() const { return total; }
+    qint64 max() const { return maxNs; }
+    qint64 mean() const { return total ? qint64(sumNs / total) : 0; }
+    // Upper bound of the bucket holding the q-quantile (0 < q <= 1)
+    qint64 percentile(double q) const;
+
+    // "n=…, p50=…, p99=…, max=…" with microsecond figures
+    QString summary() const;
+
+private:
+    static int bucketOf(quint64 nanoseconds);
+    static quint64 upperBoundOf(int bucket);
+
+    quint64 counts[BUCKETS];
+    quint64 total;
+    quint64 sumNs;
+    qint64 maxNs;
+};
+
+#endif // LATENCYHISTOGRAM_H
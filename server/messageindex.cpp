@@ -0,0 +1,162 @@
+// messageindex.cpp
+#include "messageindex.h"
+#include <QtMath>
+#include <algorithm>
+
+QStringList MessageIndex::tokenize(const QString &text) {
+    QStringList tokens;
+    const QString folded = text.toCaseFolded();
+    int start = -1;
+    for (int i = 0; i <= folded.size(); ++i) {
+        bool inWord = i < folded.size() &&
+                      (folded.at(i).isLetterOrNumber() || folded.at(i).isMark() ||
+                       folded.at(i).isSurrogate());
+        if (inWord && start < 0) {
+            start = i;
+        } else if (!inWord && start >= 0) {
+            tokens.append(folded.mid(start, i - start));
+            start = -1;
+        }
+    }
+    return tokens;
+}
+
+quint32 MessageIndex::roomSlot(const QString &roomId) {
+    auto it = roomSlots.constFind(roomId);
+    if (it != roomSlots.constEnd()) {
+        return it.value();
+    }
+    quint32 slot = quint32(rooms.size());
+    rooms.append(roomId);
+    roomSlots.insert(roomId, slot);
+    return slot;
+}
+
+void MessageIndex::appendVarint(QByteArray &bytes, quint32 value) {
+    while (value >= 0x80) {
+        bytes.append(char((value & 0x7F) | 0x80));
+        value >>= 7;
+    }
+    bytes.append(char(value));
+}
+
+void MessageIndex::decode(const PostingList &list, QVector<QPair<quint32, quint32>> &out) {
+    out.clear();
+    out.reserve(int(list.docCount));
+    const uchar *p = reinterpret_cast<const uchar *>(list.bytes.constData());
+    const uchar *end = p + list.bytes.size();
+    quint32 doc = 0;
+    bool first = true;
+    while (p < end) {
+        quint32 values[2] = {0, 0};
+        for (quint32 &value : values) {
+            int shift = 0;
+            while (p < end) {
+                uchar byte = *p++;
+                value |= quint32(byte & 0x7F) << shift;
+                if (!(byte & 0x80)) {
+                    break;
+                }
+                shift += 7;
+            }
+        }
+        doc = first ? values[0] : doc + values[0];
+        first = false;
+        out.append(qMakePair(doc, values[1]));
+    }
+}
+
+void MessageIndex::add(quint32 room, quint64 seq, const QString &text) {
+    addTokens(room, seq, tokenize(text));
+}
+
+void MessageIndex::addTokens(quint32 room, quint64 seq, const QStringList &tokens) {
+    quint32 id = quint32(docs.size());
+    docs.append(Doc{room, seq});
+
+    // Count each term once per message
+    QHash<QString, quint32> counts;
+    for (const QString &token : tokens) {
+        ++counts[token];
+    }
+    for (auto it = counts.constBegin(); it != counts.constEnd(); ++it) {
+        PostingList &list = postings[it.key()];
+        appendVarint(list.bytes, list.docCount == 0 ? id : id - list.lastDoc);
+        appendVarint(list.bytes, it.value());
+        list.lastDoc = id;
+        ++list.docCount;
+    }
+}
+
+QVector<MessageIndex::Match> MessageIndex::search(const QStringList &terms,
+                                                  int maxResults) const {
+    QVector<Match> matches;
+    if (terms.isEmpty() || maxResults <= 0 || docs.isEmpty()) {
+        return matches;
+    }
+
+    // Every term must be present; start from the rarest list so the
+    // candidate set only shrinks
+    QVector<const PostingList *> lists;
+    for (const QString &term : terms) {
+        auto it = postings.constFind(term);
+        if (it == postings.constEnd()) {
+            return matches;
+        }
+        lists.append(&it.value());
+    }
+    std::sort(lists.begin(), lists.end(),
+              [](const PostingList *a, const PostingList *b) { return a->docCount < b->docCount; });
+
+    auto idf = [this](const PostingList *list) {
+        return qLn(1.0 + double(docs.size()) / double(list->docCount));
+    };
+
+    QVector<QPair<quint32, quint32>> candidates;
+    decode(*lists.first(), candidates);
+    double firstIdf = idf(lists.first());
+    matches.reserve(candidates.size());
+    for (const auto &posting : candidates) {
+        matches.append(Match{posting.first, posting.second * firstIdf});
+    }
+
+    QVector<QPair<quint32, quint32>> other;
+    for (int i = 1; i < lists.size() && !matches.isEmpty(); ++i) {
+        decode(*lists[i], other);
+        double weight = idf(lists[i]);
+        int kept = 0;
+        int j = 0;
+        for (const Match &match : matches) {
+            while (j < other.size() && other[j].first < match.doc) {
+                ++j;
+            }
+            if (j < other.size() && other[j].first == match.doc) {
+                matches[kept++] = Match{match.doc, match.score + other[j].second * weight};
+            }
+        }
+        matches.resize(kept);
+    }
+
+    auto better = [](const Match &a, const Match &b) {
+        return a.score != b.score ? a.score > b.score : a.doc > b.doc;
+    };
+    if (matches.size() > maxResults) {
+        std::partial_sort(matches.begin(), matches.begin() + maxResults, matches.end(), better);
+        matches.resize(maxResults);
+    } else {
+        std::sort(matches.begin(), matches.end(), better);
+    }
+    return matches;
+}
+
+qint64 MessageIndex::residentBytes() const {
+    qint64 bytes = sizeof(MessageIndex) + docs.capacity() * qint64(sizeof(Doc));
+    for (auto it = postings.constBegin(); it != postings.constEnd(); ++it) {
+        bytes += sizeof(PostingList) + it.value().bytes.capacity() +
+                 it.key().capacity() * qint64(sizeof(QChar));
+    }
+    for (const QString &room : rooms) {
+        bytes += 2 * (sizeof(QString) + room.capacity() * qint64(sizeof(QChar)));
+    }
+    return bytes;
+}
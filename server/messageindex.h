@@ -0,0 +1,63 @@
+// messageindex.h
+#ifndef MESSAGEINDEX_H
+#define MESSAGEINDEX_H
+
+#include <QByteArray>
+#include <QHash>
+#include <QString>
+#include <QStringList>
+#include <QVector>
+#include <QtGlobal>
+
+// Inverted index over one user's messages. Documents are numbered in the
+// order they were added, which is oldest first, and each term's posting list
+// stores (document gap, term count) pairs as varints. That keeps a list to
+// about two bytes per posting, and appending a message only writes to the
+// tail of the lists for its terms.
+class MessageIndex {
+public:
+    struct Doc {
+        quint32 room; // Slot from roomSlot()
+        quint64 seq;  // Sequence number within the room
+    };
+    struct Match {
+        quint32 doc;
+        double score;
+    };
+
+    // Case-folded words and numbers, in the order they appear
+    static QStringList tokenize(const QString &text);
+
+    quint32 roomSlot(const QString &roomId);
+    QString roomAt(quint32 slot) const { return rooms.at(int(slot)); }
+
+    void add(quint32 room, quint64 seq, const QString &text);
+    // The same with the text already tokenized, e.g. on another thread
+    void addTokens(quint32 room, quint64 seq, const QStringList &tokens);
+
+    // Documents containing every term, best first: term frequency weighted by
+    // rarity, newer messages winning ties. Only the top maxResults are sorted.
+    QVector<Match> search(const QStringList &terms, int maxResults) const;
+    const Doc &doc(quint32 id) const { return docs.at(int(id)); }
+
+    int docCount() const { return docs.size(); }
+    int termCount() const { return postings.size(); }
+    qint64 residentBytes() const;
+
+private:
+    struct PostingList {
+        QByteArray bytes;    // varint(doc - previous doc), varint(count), ...
+        quint32 lastDoc = 0; // For the next gap
+        quint32 docCount = 0;
+    };
+
+    QVector<Doc> docs;
+    QStringList rooms;
+    QHash<QString, quint32> roomSlots;
+    QHash<QString, PostingList> postings;
+
+    static void appendVarint(QByteArray &bytes, quint32 value);
+    static void decode(const PostingList &list, QVector<QPair<quint32, quint32>> &out);
+};
+
+#endif // MESSAGEINDEX_H
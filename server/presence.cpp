@@ -0,0 +1,193 @@
+// presence.cpp
+#include "presence.h"
+
+PresenceEngine::PresenceEngine(qint64 ttlMs, qint64 tickMs, int slotCount)
+    : ttlMs(ttlMs), tickMs(tickMs), currentTick(-1), online(0) {
+    // The wheel must span the TTL so a deadline never laps it
+    int slots = qMax(slotCount, int(ttlMs / tickMs) + 2);
+    wheel.resize(slots);
+}
+
+void PresenceEngine::schedule(UserHandle user, qint64 deadlineMs) {
+    wheel[int(dueTick(deadlineMs) % wheel.size())].append(user);
+}
+
+void PresenceEngine::expire(UserHandle user, Entry &entry, qint64 atMs) {
+    entry.online = false;
+    entry.lastChangeMs = atMs;
+    --online;
+    publish(Change{user, false, atMs});
+}
+
+void PresenceEngine::heartbeat(UserHandle user, qint64 nowMs) {
+    if (user == 0) {
+        return;
+    }
+    if (currentTick < 0) {
+        currentTick = nowMs / tickMs;
+    }
+
+    Entry &entry = table[user];
+    if (!entry.online || entry.deadlineMs <= nowMs) {
+        if (entry.online) {
+            // Lapsed but not yet swept: count it as a fresh sign-on
+            expire(user, entry, entry.deadlineMs);
+        }
+        entry.online = true;
+        entry.lastChangeMs = nowMs;
+        ++online;
+        publish(Change{user, true, nowMs});
+    }
+
+    // Only reschedule when the deadline moves to a later tick; stale wheel
+    // entries are skipped when their slot comes round
+    qint64 deadline = nowMs + ttlMs;
+    if (dueTick(deadline) != dueTick(entry.deadlineMs)) {
+        schedule(user, deadline);
+    }
+    entry.deadlineMs = deadline;
+}
+
+void PresenceEngine::goOffline(UserHandle user, qint64 nowMs) {
+    auto it = table.find(user);
+    if (it != table.end() && it.value().online) {
+        expire(user, it.value(), nowMs);
+    }
+}
+
+bool PresenceEngine::isOnline(UserHandle user, qint64 nowMs) const {
+    auto it = table.constFind(user);
+    return it != table.constEnd() && it.value().online && it.value().deadlineMs > nowMs;
+}
+
+qint64 PresenceEngine::lastChange(UserHandle user) const {
+    return table.value(user).lastChangeMs;
+}
+
+void PresenceEngine::advance(qint64 nowMs) {
+    qint64 nowTick = nowMs / tickMs;
+    if (currentTick < 0) {
+        currentTick = nowTick;
+        return;
+    }
+
+    // Every deadline filed under a tick up to nowTick has passed, so a
+    // user goes offline within one tick of their deadline. A jump longer
+    // than the wheel visits every slot once.
+    qint64 steps = qMin<qint64>(nowTick - currentTick, wheel.size());
+    for (qint64 i = 1; i <= steps; ++i) {
+        QVector<UserHandle> &slot = wheel[int((currentTick + i) % wheel.size())];
+        QVector<UserHandle> keep;
+        for (UserHandle user : slot) {
+            auto it = table.find(user);
+            if (it == table.end() || !it.value().online) {
+                continue; // Already offline
+            }
+            if (it.value().deadlineMs <= nowMs) {
+                expire(user, it.value(), it.value().deadlineMs);
+            } else if (dueTick(it.value().deadlineMs) % wheel.size() ==
+                       (currentTick + i) % wheel.size()) {
+                keep.append(user); // Due on a later lap of this slot
+            }
+        }
+        slot.swap(keep);
+    }
+    currentTick = qMax(currentTick, nowTick);
+}
+
+QVector<PresenceEngine::Change> PresenceEngine::takeChanges() {
+    QVector<Change> result;
+    result.swap(changes);
+    return result;
+}
+
+void PresenceEngine::publish(const Change &change) {
+    changes.append(change);
+
+    // Later changes for the same target overwrite earlier ones, so a watcher
+    // that drains slowly still sees each user once
+    auto it = subscribers.constFind(change.user);
+    if (it == subscribers.constEnd()) {
+        return;
+    }
+    for (UserHandle watcher : it.value()) {
+        pending[watcher].insert(change.user, change);
+    }
+}
+
+void PresenceEngine::unsubscribe(UserHandle watcher, UserHandle target) {
+    auto it = subscribers.find(target);
+    if (it == subscribers.end()) {
+        return;
+    }
+    QVector<UserHandle> &watchers = it.value();
+    int index = watchers.indexOf(watcher);
+    if (index >= 0) {
+        watchers[index] = watchers.last();
+        watchers.removeLast();
+    }
+    if (watchers.isEmpty()) {
+        subscribers.erase(it);
+    }
+}
+
+void PresenceEngine::setInterests(UserHandle watcher, const QVector<UserHandle> &targets,
+                                  qint64 nowMs) {
+    if (watcher == 0) {
+        return;
+    }
+
+    QSet<UserHandle> wanted;
+    wanted.reserve(targets.size());
+    for (UserHandle target : targets) {
+        if (target != 0 && target != watcher) {
+            wanted.insert(target);
+        }
+    }
+
+    QSet<UserHandle> &current = interests[watcher];
+    for (UserHandle target : current) {
+        if (!wanted.contains(target)) {
+            unsubscribe(watcher, target);
+            pending[watcher].remove(target);
+        }
+    }
+    for (UserHandle target : wanted) {
+        if (current.contains(target)) {
+            continue;
+        }
+        subscribers[target].append(watcher);
+        // Seed the new subscription with where the user stands right now
+        pending[watcher].insert(target, Change{target, isOnline(target, nowMs), lastChange(target)});
+    }
+    current.swap(wanted);
+
+    if (current.isEmpty()) {
+        interests.remove(watcher);
+    }
+}
+
+void PresenceEngine::dropInterests(UserHandle watcher) {
+    auto it = interests.find(watcher);
+    if (it != interests.end()) {
+        for (UserHandle target : it.value()) {
+            unsubscribe(watcher, target);
+        }
+        interests.erase(it);
+    }
+    pending.remove(watcher);
+}
+
+QVector<PresenceEngine::Change> PresenceEngine::takeUpdates(UserHandle watcher) {
+    QVector<Change> result;
+    auto it = pending.find(watcher);
+    if (it == pending.end()) {
+        return result;
+    }
+    result.reserve(it.value().size());
+    for (const Change &change : it.value()) {
+        result.append(change);
+    }
+    pending.erase(it);
+    return result;
+}
@@ -0,0 +1,87 @@
+// presence.h
+#ifndef PRESENCE_H
+#define PRESENCE_H
+
+#include <QHash>
+#include <QSet>
+#include <QVector>
+#include <QtGlobal>
+#include "../client/userids.h"
+
+// In-memory presence table. A user is online while their heartbeats keep
+// arriving; one that stops (closed window, crash) expires after the TTL.
+// Expiries are found with a hashed timer wheel, so advancing time only
+// touches the users whose deadline falls in the elapsed ticks. Nothing here
+// touches the disk.
+//
+// Transitions are fanned out only to the sessions that subscribed to that
+// user (their contacts and visible rows), so one user going online costs
+// work proportional to their subscribers, not to the whole directory.
+class PresenceEngine {
+public:
+    struct Change {
+        UserHandle user;
+        bool online;
+        qint64 atMs; // When the transition happened
+    };
+
+    PresenceEngine(qint64 ttlMs, qint64 tickMs, int slotCount);
+
+    // A client is alive: online until nowMs + TTL
+    void heartbeat(UserHandle user, qint64 nowMs);
+    // Explicit sign-off (user chose to appear offline)
+    void goOffline(UserHandle user, qint64 nowMs);
+
+    // Exact at any time, even if advance() has not run yet
+    bool isOnline(UserHandle user, qint64 nowMs) const;
+    // When the user's status last changed, or 0 if never seen
+    qint64 lastChange(UserHandle user) const;
+
+    // Move the wheel to nowMs, expiring users whose heartbeats stopped
+    void advance(qint64 nowMs);
+    // Transitions since the last call, oldest first
+    QVector<Change> takeChanges();
+
+    // Replace everything a watcher is subscribed to with targets. Only the
+    // difference is applied; newly watched users get their current state
+    // queued so the watcher never has to poll them.
+    void setInterests(UserHandle watcher, const QVector<UserHandle> &targets, qint64 nowMs);
+    void dropInterests(UserHandle watcher);
+    // Pending updates for one watcher, at most one (the latest) per target
+    QVector<Change> takeUpdates(UserHandle watcher);
+    int subscriberCount(UserHandle target) const { return subscribers.value(target).size(); }
+
+    qint64 getTtl() const { return ttlMs; }
+    int onlineCount() const { return online; }
+
+private:
+    struct Entry {
+        qint64 deadlineMs = 0;   // Online until this time
+        qint64 lastChangeMs = 0; // Last online/offline transition
+        bool online = false;
+    };
+
+    QHash<UserHandle, Entry> table;
+    QVector<QVector<UserHandle>> wheel; // Slot = dueTick(deadline) modulo slot count
+    qint64 ttlMs;
+    qint64 tickMs;
+    qint64 currentTick;                 // Last tick advance() processed
+    int online;
+    QVector<Change> changes;
+
+    // Subscriptions, indexed both ways so a change finds its watchers and a
+    // watcher's interest list can be diffed
+    QHash<UserHandle, QVector<UserHandle>> subscribers; // Target -> watchers
+    QHash<UserHandle, QSet<UserHandle>> interests;       // Watcher -> targets
+    QHash<UserHandle, QHash<UserHandle, Change>> pending; // Watcher -> (target -> latest change)
+
+    void publish(const Change &change);
+    void unsubscribe(UserHandle watcher, UserHandle target);
+    void schedule(UserHandle user, qint64 deadlineMs);
+    // First tick boundary at or after the deadline, so by the time that
+    // tick is swept the deadline has passed
+    qint64 dueTick(qint64 deadlineMs) const { return (deadlineMs + tickMs - 1) / tickMs; }
+    void expire(UserHandle user, Entry &entry, qint64 atMs);
+};
+
+#endif // PRESENCE_H
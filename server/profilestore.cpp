@@ -0,0 +1,281 @@
+// profilestore.cpp
+#include "profilestore.h"
+#include "taskpool.h"
+#include <QBitArray>
+#include <QDebug>
+#include <algorithm>
+
+// Average keys per bucket; small buckets are quick to place
+static const int KEYS_PER_BUCKET = 4;
+
+// Give up on a seed after this many displacements for one bucket
+static const quint32 MAX_DISPLACEMENT = 1u << 20;
+
+// Marks a displacement that is really a slot number (single-key buckets)
+static const quint32 DIRECT_SLOT = 0x80000000u;
+
+// Overlay size that triggers a background rebuild
+static const int OVERLAY_REBUILD_THRESHOLD = 64;
+
+static quint64 mix64(quint64 x) {
+    x ^= x >> 30;
+    x *= 0xBF58476D1CE4E5B9ULL;
+    x ^= x >> 27;
+    x *= 0x94D049BB133111EBULL;
+    x ^= x >> 31;
+    return x;
+}
+
+quint64 ProfileSnapshot::hashOf(const QString &userId, quint64 seed) {
+    quint64 hash = 0xCBF29CE484222325ULL ^ seed; // FNV-1a over UTF-16 units
+    for (QChar ch : userId) {
+        hash ^= ch.unicode();
+        hash *= 0x100000001B3ULL;
+    }
+    return mix64(hash);
+}
+
+quint32 ProfileSnapshot::slotFor(quint64 hash, quint32 displacement, int slotCount) {
+    return quint32(mix64(hash ^ (quint64(displacement) * 0x9E3779B97F4A7C15ULL)) %
+                   quint64(slotCount));
+}
+
+ProfileSnapshot *ProfileSnapshot::build(const QVector<QPair<QString, UserProfile>> &users) {
+    ProfileSnapshot *snapshot = new ProfileSnapshot;
+    const int n = users.size();
+    if (n == 0) {
+        return snapshot;
+    }
+
+    const int bucketCount = qMax(1, n / KEYS_PER_BUCKET);
+    QVector<quint64> hashes(n);
+    for (quint64 seed = 0x2545F4914F6CDD1DULL;; seed = mix64(seed + 1)) {
+        for (int i = 0; i < n; ++i) {
+            hashes[i] = hashOf(users[i].first, seed);
+        }
+
+        QVector<QVector<int>> buckets(bucketCount);
+        for (int i = 0; i < n; ++i) {
+            buckets[int((hashes[i] >> 32) % quint64(bucketCount))].append(i);
+        }
+        QVector<int> order(bucketCount);
+        for (int b = 0; b < bucketCount; ++b) {
+            order[b] = b;
+        }
+        std::sort(order.begin(), order.end(), [&buckets](int a, int b) {
+            return buckets[a].size() > buckets[b].size();
+        });
+
+        // Largest buckets first, while the table is emptiest
+        QVector<quint32> displacements(bucketCount, 0);
+        QVector<int> slotOf(n, -1);
+        QBitArray taken(n);
+        int freeCursor = 0;
+        bool placed = true;
+        for (int b : order) {
+            const QVector<int> &members = buckets[b];
+            if (members.isEmpty()) {
+                break; // Sorted by size, so the rest are empty too
+            }
+            if (members.size() == 1) {
+                // Any free slot will do; store it directly
+                while (taken.testBit(freeCursor)) {
+                    ++freeCursor;
+                }
+                taken.setBit(freeCursor);
+                slotOf[members[0]] = freeCursor;
+                displacements[b] = DIRECT_SLOT | quint32(freeCursor);
+                continue;
+            }
+
+            bool found = false;
+            QVector<int> candidate(members.size());
+            for (quint32 d = 0; d < MAX_DISPLACEMENT && !found; ++d) {
+                found = true;
+                for (int m = 0; m < members.size() && found; ++m) {
+                    int slot = int(slotFor(hashes[members[m]], d, n));
+                    if (taken.testBit(slot)) {
+                        found = false;
+                    }
+                    for (int k = 0; k < m && found; ++k) {
+                        found = candidate[k] != slot;
+                    }
+                    candidate[m] = slot;
+                }
+                if (found) {
+                    displacements[b] = d;
+                    for (int m = 0; m < members.size(); ++m) {
+                        taken.setBit(candidate[m]);
+                        slotOf[members[m]] = candidate[m];
+                    }
+                }
+            }
+            if (!found) {
+                placed = false;
+                break;
+            }
+        }
+        if (!placed) {
+            qDebug() << "Profile snapshot: retrying with a new hash seed";
+            continue;
+        }
+
+        snapshot->seed = seed;
+        snapshot->displacements = displacements;
+        snapshot->slots.resize(n);
+        for (int i = 0; i < n; ++i) {
+            Slot &slot = snapshot->slots[slotOf[i]];
+            slot.fingerprint = hashes[i];
+            slot.profile = users[i].second;
+            slot.userId = users[i].first;
+        }
+        return snapshot;
+    }
+}
+
+const UserProfile *ProfileSnapshot::find(const QString &userId) const {
+    if (slots.isEmpty()) {
+        return nullptr;
+    }
+    quint64 hash = hashOf(userId, seed);
+    quint32 d = displacements[int((hash >> 32) % quint64(displacements.size()))];
+    int index = (d & DIRECT_SLOT) ? int(d & ~DIRECT_SLOT) : int(slotFor(hash, d, slots.size()));
+    const Slot &slot = slots[index];
+    return slot.fingerprint == hash ? &slot.profile : nullptr;
+}
+
+QVector<QPair<QString, UserProfile>> ProfileSnapshot::entries() const {
+    QVector<QPair<QString, UserProfile>> result;
+    result.reserve(slots.size());
+    for (const Slot &slot : slots) {
+        result.append(qMakePair(slot.userId, slot.profile));
+    }
+    return result;
+}
+
+qint64 ProfileSnapshot::residentBytes() const {
+    qint64 bytes = sizeof(ProfileSnapshot) + displacements.capacity() * qint64(sizeof(quint32)) +
+                   slots.capacity() * qint64(sizeof(Slot));
+    for (const Slot &slot : slots) {
+        bytes += (slot.userId.capacity() + slot.profile.nickname.capacity() +
+                  slot.profile.bio.capacity() + slot.profile.avatarPath.capacity()) *
+                 qint64(sizeof(QChar));
+    }
+    return bytes;
+}
+
+ProfileStore::ProfileStore(TaskPool *pool)
+    : base(ProfileSnapshot::build({})), writeSeq(0), pool(pool), building(false),
+      builderSeq(0) {}
+
+ProfileStore::~ProfileStore() {
+    waitForRebuild();
+    delete rebuilt.fetchAndStoreOrdered(nullptr);
+}
+
+void ProfileStore::reset(const QVector<QPair<QString, UserProfile>> &users) {
+    // A rebuild in flight is based on data we are about to replace
+    waitForRebuild();
+    delete rebuilt.fetchAndStoreOrdered(nullptr);
+    base = QSharedPointer<const ProfileSnapshot>(ProfileSnapshot::build(users));
+    overlay.clear();
+}
+
+bool ProfileStore::put(const QString &userId, const UserProfile &profile) {
+    // Unchanged profiles would only grow the overlay toward a rebuild
+    const UserProfile *current = find(userId);
+    if (current && *current == profile) {
+        return false;
+    }
+    Change &change = overlay[userId];
+    change.profile = profile;
+    change.removed = false;
+    change.writeSeq = ++writeSeq;
+    maintain();
+    return true;
+}
+
+bool ProfileStore::remove(const QString &userId) {
+    if (!find(userId)) {
+        return false;
+    }
+    Change &change = overlay[userId];
+    change.profile = UserProfile();
+    change.removed = true;
+    change.writeSeq = ++writeSeq;
+    maintain();
+    return true;
+}
+
+void ProfileStore::maintain() {
+    if (building && builderDone.tryAcquire()) {
+        building = false;
+        installRebuilt();
+    }
+    if (!building && overlay.size() >= OVERLAY_REBUILD_THRESHOLD) {
+        startRebuild();
+    }
+}
+
+void ProfileStore::startRebuild() {
+    // The job works from its own references: the snapshot is immutable
+    // and the overlay copy is implicitly shared, so writes here carry on
+    QSharedPointer<const ProfileSnapshot> from = base;
+    QHash<QString, Change> changes = overlay;
+    builderSeq = writeSeq;
+    building = true;
+
+    std::function<void()> job = [this, from, changes]() {
+        QVector<QPair<QString, UserProfile>> users;
+        users.reserve(from->size() + changes.size());
+        for (const auto &entry : from->entries()) {
+            if (!changes.contains(entry.first)) {
+                users.append(entry);
+            }
+        }
+        for (auto it = changes.constBegin(); it != changes.constEnd(); ++it) {
+            if (!it.value().removed) {
+                users.append(qMakePair(it.key(), it.value().profile));
+            }
+        }
+        rebuilt.storeRelease(ProfileSnapshot::build(users));
+        builderDone.release();
+    };
+    if (pool) {
+        pool->submit(job, TaskPool::Background);
+    } else {
+        job();
+    }
+}
+
+void ProfileStore::waitForRebuild() {
+    if (building) {
+        builderDone.acquire();
+        building = false;
+    }
+}
+
+void ProfileStore::installRebuilt() {
+    ProfileSnapshot *fresh = rebuilt.fetchAndStoreOrdered(nullptr);
+    if (!fresh) {
+        return;
+    }
+    base = QSharedPointer<const ProfileSnapshot>(fresh);
+
+    // Changes the rebuild already contains leave the overlay; later ones stay
+    for (auto it = overlay.begin(); it != overlay.end();) {
+        if (it.value().writeSeq <= builderSeq) {
+            it = overlay.erase(it);
+        } else {
+            ++it;
+        }
+    }
+    qDebug() << "Installed profile snapshot of" << base->size() << "users;"
+             << overlay.size() << "changes still in the overlay";
+}
+
+qint64 ProfileStore::residentBytes() const {
+    qint64 bytes = base ? base->residentBytes() : 0;
+    bytes += overlay.size() * qint64(sizeof(Change) + sizeof(QString));
+    return bytes;
+}
@@ -0,0 +1,142 @@
+// profilestore.h
+#ifndef PROFILESTORE_H
+#define PROFILESTORE_H
+
+#include <QAtomicPointer>
+#include <QHash>
+#include <QPair>
+#include <QSemaphore>
+#include <QSharedPointer>
+#include <QString>
+#include <QVector>
+#include <QtGlobal>
+#include "../client/userids.h"
+
+class TaskPool;
+
+// What the UI reads about a user on every repaint
+struct UserProfile {
+    UserHandle handle = 0;
+    QString nickname;
+    QString bio;
+    QString avatarPath;
+
+    bool operator==(const UserProfile &other) const {
+        return handle == other.handle && nickname == other.nickname && bio == other.bio &&
+               avatarPath == other.avatarPath;
+    }
+    bool operator!=(const UserProfile &other) const { return !(*this == other); }
+};
+
+// Immutable profile table indexed by a minimal perfect hash: n users fill
+// exactly n slots. Keys are hashed into small buckets, and each bucket
+// stores the displacement that sends its keys to free slots. A lookup
+// reads one displacement, then one slot holding the profile next to a
+// 64-bit fingerprint of the email. Unknown emails are rejected by that
+// fingerprint, so a lookup never touches the email text.
+class ProfileSnapshot {
+public:
+    static ProfileSnapshot *build(const QVector<QPair<QString, UserProfile>> &users);
+
+    const UserProfile *find(const QString &userId) const;
+    int size() const { return slots.size(); }
+    qint64 residentBytes() const;
+
+    // Every (email, profile) pair, for rebuilding
+    QVector<QPair<QString, UserProfile>> entries() const;
+
+private:
+    struct Slot {
+        quint64 fingerprint;
+        UserProfile profile;
+        QString userId; // Only read when rebuilding
+    };
+
+    quint64 seed = 0;
+    QVector<quint32> displacements; // Per bucket; high bit = slot stored directly
+    QVector<Slot> slots;
+
+    static quint64 hashOf(const QString &userId, quint64 seed);
+    static quint32 slotFor(quint64 hash, quint32 displacement, int slotCount);
+};
+
+// Read-mostly view of every user's profile: a ProfileSnapshot plus a small
+// overlay of changes made since it was built. Once the overlay has grown,
+// a new snapshot is merged as a background job, and maintain() swaps it
+// in on the owning thread. Reads take no locks.
+class ProfileStore {
+private:
+    struct Change {
+        UserProfile profile;
+        bool removed = false;
+        quint64 writeSeq = 0; // Which write this was, to tell it apart from later ones
+    };
+
+public:
+    // Frozen copy of the store's contents. Both parts are immutable or
+    // implicitly shared, so a View can be read from any thread while the
+    // store keeps changing.
+    class View {
+    public:
+        const UserProfile *find(const QString &userId) const {
+            auto it = overlay.constFind(userId);
+            if (it != overlay.constEnd()) {
+                return it.value().removed ? nullptr : &it.value().profile;
+            }
+            return base ? base->find(userId) : nullptr;
+        }
+
+    private:
+        friend class ProfileStore;
+        QSharedPointer<const ProfileSnapshot> base;
+        QHash<QString, Change> overlay;
+    };
+
+    // Rebuilds run as background jobs on the pool, or inline without one
+    explicit ProfileStore(TaskPool *pool = nullptr);
+    ~ProfileStore();
+
+    // Replace everything, synchronously (startup)
+    void reset(const QVector<QPair<QString, UserProfile>> &users);
+    // Both return false, and leave the overlay alone, when nothing changes
+    bool put(const QString &userId, const UserProfile &profile);
+    bool remove(const QString &userId);
+
+    // Null for unknown users. Valid until the next put, remove or maintain.
+    const UserProfile *find(const QString &userId) const {
+        auto it = overlay.constFind(userId);
+        if (it != overlay.constEnd()) {
+            return it.value().removed ? nullptr : &it.value().profile;
+        }
+        return base ? base->find(userId) : nullptr;
+    }
+    View view() const {
+        View frozen;
+        frozen.base = base;
+        frozen.overlay = overlay;
+        return frozen;
+    }
+
+    // Install a finished rebuild and start another if the overlay is large
+    void maintain();
+    int overlaySize() const { return overlay.size(); }
+    qint64 residentBytes() const;
+
+private:
+    QSharedPointer<const ProfileSnapshot> base;
+    QHash<QString, Change> overlay;
+    quint64 writeSeq;
+
+    // Background rebuild
+    TaskPool *pool;
+    bool building;                           // A rebuild job is outstanding
+    QSemaphore builderDone;                  // Released by the job when it finishes
+    quint64 builderSeq;                      // Last write the rebuild includes
+    QAtomicPointer<ProfileSnapshot> rebuilt; // Set by the job when done
+
+    void startRebuild();
+    void waitForRebuild();
+    void installRebuilt();
+};
+
+#endif // PROFILESTORE_H
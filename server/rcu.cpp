@@ -0,0 +1,97 @@
+// rcu.cpp
+#include "rcu.h"
+#include <QThread>
+#include <atomic>
+
+EpochDomain *EpochDomain::instance = nullptr;
+
+EpochDomain *EpochDomain::getInstance() {
+    // Created before any worker thread starts, by the server's constructor
+    if (!instance) {
+        instance = new EpochDomain();
+    }
+    return instance;
+}
+
+// Each thread's reader slot, handed back when the thread exits
+struct EpochThreadState {
+    int slot = -1;
+    int depth = 0;
+
+    ~EpochThreadState() {
+        if (slot >= 0) {
+            EpochDomain::getInstance()->readers[slot].claimed.storeRelease(0);
+        }
+    }
+};
+
+static thread_local EpochThreadState threadState;
+
+int EpochDomain::claimSlot() {
+    for (;;) {
+        for (int i = 0; i < MAX_READERS; ++i) {
+            if (readers[i].claimed.loadRelaxed() == 0 &&
+                readers[i].claimed.testAndSetAcquire(0, 1)) {
+                return i;
+            }
+        }
+        // More reader threads than slots: wait for one to exit
+        QThread::yieldCurrentThread();
+    }
+}
+
+void EpochDomain::enter() {
+    if (threadState.depth++ > 0) {
+        return;
+    }
+    if (threadState.slot < 0) {
+        threadState.slot = claimSlot();
+    }
+    // Announce, then a full fence: the pointer load after this must not be
+    // reordered before the announcement, or reclaim could miss us and free
+    // what we are about to read (store-load ordering needs seq_cst)
+    readers[threadState.slot].epoch.fetchAndStoreOrdered(globalEpoch.loadAcquire());
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+}
+
+void EpochDomain::leave() {
+    if (--threadState.depth == 0) {
+        readers[threadState.slot].epoch.storeRelease(0);
+    }
+}
+
+void EpochDomain::retire(std::function<void()> deleter) {
+    // Readers entering from now on get a later epoch and can only see the
+    // new version, so this object waits for readers at or before this epoch
+    quint64 epoch = globalEpoch.fetchAndAddOrdered(1);
+    retired.append(Retired{epoch, std::move(deleter)});
+}
+
+int EpochDomain::reclaim() {
+    if (retired.isEmpty()) {
+        return 0;
+    }
+
+    // Pairs with the fence in enter(): either we see a reader's
+    // announcement, or that reader sees the pointer published before it
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    quint64 oldestReader = globalEpoch.loadAcquire();
+    for (const ReaderSlot &reader : readers) {
+        quint64 epoch = reader.epoch.loadAcquire();
+        if (epoch != 0 && epoch < oldestReader) {
+            oldestReader = epoch;
+        }
+    }
+
+    int kept = 0;
+    for (int i = 0; i < retired.size(); ++i) {
+        if (retired[i].epoch < oldestReader) {
+            retired[i].deleter();
+        } else {
+            retired[kept++] = retired[i];
+        }
+    }
+    int freed = retired.size() - kept;
+    retired.resize(kept);
+    return freed;
+}
@@ -0,0 +1,107 @@
+// rcu.h
+#ifndef RCU_H
+#define RCU_H
+
+#include <QAtomicInteger>
+#include <QAtomicPointer>
+#include <QVector>
+#include <QtGlobal>
+#include <functional>
+
+// Epoch-based reclamation for read-copy-update. Readers announce the epoch
+// they entered in (one cache line per reader thread, so readers never write
+// to shared lines). The writer swaps in a new version, retires the old one
+// tagged with the current epoch, and frees it once every reader that could
+// still see it has left.
+class EpochDomain {
+public:
+    static const int MAX_READERS = 128; // Reader threads alive at once
+
+    static EpochDomain *getInstance();
+
+    // Read side, any thread; nestable
+    void enter();
+    void leave();
+
+    // Write side, one thread only
+    void retire(std::function<void()> deleter);
+    int reclaim(); // Returns how many retired objects were freed
+    int pendingCount() const { return retired.size(); }
+
+private:
+    EpochDomain() : globalEpoch(1) {}
+    EpochDomain(const EpochDomain &) = delete;
+    EpochDomain &operator=(const EpochDomain &) = delete;
+
+    static EpochDomain *instance;
+
+    struct alignas(64) ReaderSlot {
+        QAtomicInteger<quint64> epoch; // 0 while the thread is not reading
+        QAtomicInteger<int> claimed;
+    };
+    struct Retired {
+        quint64 epoch;
+        std::function<void()> deleter;
+    };
+
+    QAtomicInteger<quint64> globalEpoch;
+    ReaderSlot readers[MAX_READERS];
+    QVector<Retired> retired;
+
+    int claimSlot();
+    friend struct EpochThreadState;
+};
+
+// RAII read-side section
+class RcuReadGuard {
+public:
+    RcuReadGuard() { EpochDomain::getInstance()->enter(); }
+    ~RcuReadGuard() { EpochDomain::getInstance()->leave(); }
+    RcuReadGuard(const RcuReadGuard &) = delete;
+    RcuReadGuard &operator=(const RcuReadGuard &) = delete;
+};
+
+// A pointer to an immutable T that one writer replaces and many readers
+// load. Readers must hold an RcuReadGuard for as long as they use it.
+template <class T>
+class RcuPointer {
+public:
+    explicit RcuPointer(T *initial = nullptr) : current(initial) {}
+    ~RcuPointer() { delete current.loadAcquire(); }
+    RcuPointer(const RcuPointer &) = delete;
+    RcuPointer &operator=(const RcuPointer &) = delete;
+
+    const T *load() const { return current.loadAcquire(); }
+
+    // Writer only: install next and free the old version when it is safe
+    void publish(T *next) {
+        T *old = current.fetchAndStoreOrdered(next);
+        EpochDomain *domain = EpochDomain::getInstance();
+        if (old) {
+            domain->retire([old]() { delete old; });
+        }
+        domain->reclaim();
+    }
+
+private:
+    QAtomicPointer<T> current;
+};
+
+// A loaded version plus the guard that keeps it alive
+template <class T>
+class RcuSnapshot {
+public:
+    explicit RcuSnapshot(const RcuPointer<T> &pointer) : state(pointer.load()) {}
+    RcuSnapshot(const RcuSnapshot &) = delete;
+    RcuSnapshot &operator=(const RcuSnapshot &) = delete;
+
+    const T *get() const { return state; }
+    const T *operator->() const { return state; }
+    const T &operator*() const { return *state; }
+
+private:
+    RcuReadGuard guard; // Entered before state is loaded (declaration order)
+    const T *state;
+};
+
+#endif // RCU_H
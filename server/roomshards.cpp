@@ -0,0 +1,153 @@
+// roomshards.cpp
+#include "roomshards.h"
+#include <QDebug>
+
+RoomShards::MpscQueue::MpscQueue() : head(&stub), tail(&stub) {
+    stub.next.storeRelaxed(nullptr);
+}
+
+void RoomShards::MpscQueue::push(Node *node) {
+    node->next.storeRelaxed(nullptr);
+    Node *prev = head.fetchAndStoreAcqRel(node);
+    // Between the exchange and this store the queue is briefly unlinked;
+    // pop() sees that as empty and the worker retries
+    prev->next.storeRelease(node);
+}
+
+RoomShards::Node *RoomShards::MpscQueue::pop() {
+    Node *first = tail;
+    Node *next = first->next.loadAcquire();
+
+    // Step over the stub
+    if (first == &stub) {
+        if (!next) {
+            return nullptr;
+        }
+        tail = next;
+        first = next;
+        next = next->next.loadAcquire();
+    }
+
+    if (next) {
+        tail = next;
+        return first;
+    }
+
+    // first is the last linked node; a producer may be mid-push behind it
+    if (first != head.loadAcquire()) {
+        return nullptr;
+    }
+
+    // Put the stub back behind it so first can be handed out
+    push(&stub);
+    next = first->next.loadAcquire();
+    if (next) {
+        tail = next;
+        return first;
+    }
+    return nullptr;
+}
+
+RoomShards::RoomShards(int shardCount) {
+    if (shardCount <= 0) {
+        // Leave a core for the thread that owns the server state
+        shardCount = qBound(1, QThread::idealThreadCount() - 1, 16);
+    }
+
+    shards.reserve(shardCount);
+    for (int i = 0; i < shardCount; ++i) {
+        Shard *shard = new Shard();
+        shard->worker = QThread::create([shard]() { run(shard); });
+        shard->worker->setObjectName(QString("room-shard-%1").arg(i));
+        shard->worker->start();
+        shards.append(shard);
+    }
+    qDebug() << "Started" << shardCount << "room shards";
+}
+
+RoomShards::~RoomShards() {
+    // The stop node queues behind everything already posted
+    for (Shard *shard : shards) {
+        enqueue(shard, std::function<void()>());
+    }
+    for (Shard *shard : shards) {
+        shard->worker->wait();
+        delete shard->worker;
+        delete shard;
+    }
+    shards.clear();
+}
+
+int RoomShards::shardFor(RoomKey key) const {
+    // Room keys pack two small handles, so mix before reducing
+    quint64 mixed = quint64(key) * Q_UINT64_C(0x9E3779B97F4A7C15);
+    return int((mixed >> 32) % quint64(shards.size()));
+}
+
+void RoomShards::post(RoomKey key, std::function<void()> command) {
+    if (!command) {
+        return; // An empty command is the stop signal
+    }
+    enqueue(shards[shardFor(key)], std::move(command));
+}
+
+void RoomShards::enqueue(Shard *shard, std::function<void()> command) {
+    Node *node = new Node();
+    node->command = std::move(command);
+    shard->posted.fetchAndAddRelaxed(1);
+    shard->queue.push(node);
+    shard->ready.release();
+}
+
+void RoomShards::drain(RoomKey key) {
+    drainShard(shards[shardFor(key)]);
+}
+
+void RoomShards::drainAll() {
+    for (Shard *shard : shards) {
+        drainShard(shard);
+    }
+}
+
+void RoomShards::drainShard(Shard *shard) {
+    if (shard->completed.loadAcquire() == shard->posted.loadAcquire()) {
+        return; // Nothing in flight
+    }
+
+    // A marker behind everything queued so far; it runs last
+    QSemaphore done;
+    enqueue(shard, [&done]() { done.release(); });
+    done.acquire();
+}
+
+int RoomShards::pendingCount() const {
+    quint64 pending = 0;
+    for (const Shard *shard : shards) {
+        pending += shard->posted.loadAcquire() - shard->completed.loadAcquire();
+    }
+    return int(pending);
+}
+
+void RoomShards::run(Shard *shard) {
+    for (;;) {
+        shard->ready.acquire();
+
+        // The permit means a node is queued, though its producer may not
+        // have linked it yet
+        Node *node = shard->queue.pop();
+        while (!node) {
+            QThread::yieldCurrentThread();
+            node = shard->queue.pop();
+        }
+
+        if (!node->command) {
+            delete node;
+            shard->completed.fetchAndAddRelease(1);
+            return;
+        }
+
+        node->command();
+        delete node;
+        shard->completed.fetchAndAddRelease(1);
+    }
+}
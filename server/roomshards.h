@@ -0,0 +1,78 @@
+// roomshards.h
+#ifndef ROOMSHARDS_H
+#define ROOMSHARDS_H
+
+#include <QAtomicInteger>
+#include <QAtomicPointer>
+#include <QSemaphore>
+#include <QThread>
+#include <QVector>
+#include <QtGlobal>
+#include <functional>
+#include "../client/userids.h"
+
+// Rooms partitioned across worker shards by room key. Every command for a
+// room lands on the same shard and runs there in the order it was posted, so
+// a room never needs a lock: its shard is the only thread that touches the
+// state the command owns. Commands for rooms on different shards run in
+// parallel. Any thread may post; each shard drains its own queue.
+class RoomShards {
+public:
+    // shardCount <= 0 picks one shard per spare core
+    explicit RoomShards(int shardCount = 0);
+    ~RoomShards(); // Runs everything already posted, then joins the workers
+
+    int shardCount() const { return shards.size(); }
+    int shardFor(RoomKey key) const;
+
+    // Queue a command on the room's shard; never blocks
+    void post(RoomKey key, std::function<void()> command);
+
+    // Wait until everything posted to the room's shard so far has run. Cheap
+    // when the shard is idle. Never call this from a shard's own worker.
+    void drain(RoomKey key);
+    void drainAll();
+
+    // Commands posted but not yet run, across all shards
+    int pendingCount() const;
+
+private:
+    RoomShards(const RoomShards &) = delete;
+    RoomShards &operator=(const RoomShards &) = delete;
+
+    struct Node {
+        QAtomicPointer<Node> next;
+        std::function<void()> command; // Empty on the stop node
+    };
+
+    // Intrusive multi-producer single-consumer queue (Vyukov). Producers swap
+    // themselves into head with one atomic exchange; the shard's worker is
+    // the only one that moves tail.
+    class MpscQueue {
+    public:
+        MpscQueue();
+        void push(Node *node);
+        Node *pop(); // Null if empty or a producer is mid-push
+
+    private:
+        QAtomicPointer<Node> head; // Newest node, written by producers
+        Node *tail;                // Oldest node, worker only
+        Node stub;
+    };
+
+    struct Shard {
+        MpscQueue queue;
+        QSemaphore ready;                 // One permit per queued node
+        QAtomicInteger<quint64> posted;
+        QAtomicInteger<quint64> completed;
+        QThread *worker = nullptr;
+    };
+
+    void enqueue(Shard *shard, std::function<void()> command);
+    void drainShard(Shard *shard);
+    static void run(Shard *shard);
+
+    QVector<Shard *> shards;
+};
+
+#endif // ROOMSHARDS_H
@@ -6,13 +6,80 @@
 #include <QFile>
 #include <QRegExp>
 #include <QStack>
+#include <QMetaObject>
+#include <QMutexLocker>
+#include <QSemaphore>
 #include <QTextStream>
+#include <QThread>
+#include <algorithm>
 #include <qglobal.h>
 
 // Initialize static member
 server *server::instance = nullptr;
 
-server::server() : currentClient(nullptr) { loadAllData(); }
+// Default resident-size budget; see setMemoryBudget
+static const qint64 DEFAULT_MEMORY_BUDGET = 256LL * 1024 * 1024;
+
+// Check the budget after this many appended messages
+static const int TRIM_INTERVAL = 256;
+
+// Presence expires one and a half heartbeats after the last one, so a
+// stopped client is noticed within about one heartbeat interval
+static const qint64 PRESENCE_TTL_MS = server::PRESENCE_HEARTBEAT_MS * 3 / 2;
+static const qint64 PRESENCE_TICK_MS = 250;
+static const int PRESENCE_WHEEL_SLOTS = 64;
+
+// Status-change times are written at most this often
+static const qint64 PRESENCE_FLUSH_INTERVAL_MS = 60 * 1000;
+
+// One typing event per user per room per second; an indicator outlives a
+// few missed events before it disappears
+static const qint64 TYPING_THROTTLE_MS = 1000;
+static const qint64 TYPING_TTL_MS = 4000;
+
+// A block file is compacted once its deltas outnumber the live entries
+// two to one, plus this many lines
+static const int BLOCK_FILE_SLACK = 16;
+
+// Post latencies are logged after this many posts
+static const quint64 POST_REPORT_INTERVAL = 1000;
+
+// Read watermarks move on every message, so moved ones are written in
+// batches this often (and at shutdown)
+static const qint64 ROOM_META_FLUSH_INTERVAL_MS = 5 * 1000;
+
+// How often the presence tick looks for expired stories
+static const qint64 STORY_EXPIRY_CHECK_MS = 60 * 1000;
+
+// The owner thread keeps a core; the room shards and the task pool split the
+// rest, so together they never run more threads than there are cores
+static int spareCores() { return qMax(1, QThread::idealThreadCount() - 1); }
+static int roomShardCount() { return qBound(1, spareCores() / 2, 16); }
+static int taskWorkerCount() { return qMax(1, spareCores() - roomShardCount()); }
+
+// Message index builds tokenize on the task pool from this many messages
+static const int PARALLEL_TOKENIZE_MIN = 4096;
+
+server::server()
+    : roomLogs(*RoomLogStore::getInstance()), roomShards(roomShardCount()),
+      jobs(taskWorkerCount()), memoryBudget(DEFAULT_MEMORY_BUDGET),
+      operationsSinceTrim(0),
+      presence(PRESENCE_TTL_MS, PRESENCE_TICK_MS, PRESENCE_WHEEL_SLOTS),
+      lastPresenceFlushMs(QDateTime::currentMSecsSinceEpoch()),
+      lastRoomMetaFlushMs(QDateTime::currentMSecsSinceEpoch()),
+      typing(TYPING_THROTTLE_MS, TYPING_TTL_MS), postsSinceReport(0),
+      lastStoryExpiryMs(QDateTime::currentMSecsSinceEpoch()), directoryBuilt(false),
+      profiles(&jobs),
+      published(new ServerReadState), publishedVersion(0), storiesChanged(true),
+      ownerThread(QThread::currentThread()),
+      credentialsDirty(false), currentClient(nullptr) {
+    // Room files are written on their room's shard; reads and rewrites on
+    // this thread wait for that room's queued writes first
+    roomLogs.setFileBarrier([this](const QString &roomId) {
+        roomShards.drain(UserIds::getInstance()->findRoomKeyForRoomId(roomId));
+    });
+    loadAllData();
+}
 
 server *server::getInstance() {
     // Create the instance if it doesn't exist
@@ -34,6 +101,7 @@ void server::loadAllData() {
     dir.mkpath("../db/rooms");
     dir.mkpath("../db/users");
     dir.mkpath("../db/avatars");
+    dir.mkpath("../db/rooms_meta");
 
     // Load user accounts
     loadUsersAccounts();
@@ -91,58 +159,54 @@ void server::loadAllData() {
         }
     }
 
-    // Migrate any inconsistent room files
-    migrateRoomFiles();
-    
-    // Repair any room files that might use nicknames instead of emails
-    repairInconsistentRoomFiles();
+    // The one-off repairs rewrite room and user files, so they only run
+    // until they have completed once
+    QFile repairsMarker("../db/repairs_done.txt");
+    if (!repairsMarker.exists()) {
+        // Migrate any inconsistent room files
+        migrateRoomFiles();
+        
+        // Repair any room files that might use nicknames instead of emails
+        repairInconsistentRoomFiles();
+
+        if (repairsMarker.open(QIODevice::WriteOnly | QIODevice::Text)) {
+            repairsMarker.close();
+        }
+    }
 
-    // Load room messages
+    // Index room files by name only; their contents are read when a
+    // participant logs in or the room is first opened
     QDir roomsDir("../db/rooms");
     QStringList roomFiles = roomsDir.entryList(QDir::Files);
-    qDebug() << "Loading" << roomFiles.size() << "room files...";
+    qDebug() << "Indexing" << roomFiles.size() << "room files...";
 
     for (const QString &roomFile : roomFiles) {
         QString roomId = roomFile;
         if (roomId.endsWith(".txt")) {
             roomId.chop(4); // Remove .txt extension
         }
-
-        // Open room file and load messages
-        QFile file(roomsDir.filePath(roomFile));
-        if (file.open(QIODevice::ReadOnly | QIODevice::Text)) {
-            QTextStream in(&file);
-            QList<Message> messageList;
-
-            while (!in.atEnd()) {
-                QString line = in.readLine().trimmed();
-                if (!line.isEmpty()) {
-                    Message msg = Message::fromString(line);
-                    messageList.append(msg);
-                }
-            }
-
-            file.close();
-            
-            roomMessages[roomId] = messageList;
-            qDebug() << "Loaded" << messageList.size() << "messages for room" << roomId;
-        }
+        indexRoomFile(roomId);
     }
 
-    // Load user data (contacts, rooms, settings)
-    QDir usersDir("../db/users");
-    QStringList userFiles = usersDir.entryList(QDir::Files);
-    qDebug() << "Loading" << userFiles.size() << "user files...";
-
-    for (const QString &userFile : userFiles) {
-        QString userId = userFile;
-        if (userId.endsWith(".txt")) {
-            userId.chop(4); // Remove .txt extension
-        }
-        // qobesy
+    // Blocked lists are needed for any user a logged-in user talks to, so
+    // they are the one per-user file read up front
+    for (auto it = userMap.constBegin(); it != userMap.constEnd(); ++it) {
+        loadBlockedUsers(it.key());
+    }
 
-        loadUserContacts(userId);
+    // Profile snapshot for lookups; later changes go through syncUserIndexes
+    QVector<QPair<QString, UserProfile>> profileEntries;
+    profileEntries.reserve(userMap.size());
+    for (auto it = userMap.constBegin(); it != userMap.constEnd(); ++it) {
+        UserProfile profile;
+        profile.handle = userHandle(it.key());
+        profile.nickname = it.value().nickname;
+        profile.bio = it.value().bio;
+        profile.avatarPath = it.value().avatarPath;
+        profileEntries.append(qMakePair(it.key(), profile));
     }
+    profiles.reset(profileEntries);
+    publishReadState();
 
     qDebug() << "All data loaded successfully.";
 }
@@ -182,65 +246,94 @@ void server::saveAllData() {
     QMapIterator<QString, UserData> userIter(userMap);
     while (userIter.hasNext()) {
         userIter.next();
+        saveUserSettingsFile(userIter.key());
+    }
 
-        QString email = userIter.key();
-        const UserData &userData = userIter.value();
+    // Save room messages
+    for (const RoomLogPtr &log : roomLogs.allLogs()) {
+        log->save();
+    }
 
-        QString settingsPath = "../db/settings/" + email + "_settings.txt";
-        QFile settingsFile(settingsPath);
+    // Save user data (contacts, rooms)
+    QHashIterator<UserHandle, QVector<QString>> userIt(userContacts);
+    while (userIt.hasNext()) {
+        userIt.next();
 
-        if (settingsFile.open(QIODevice::WriteOnly | QIODevice::Text)) {
-            QTextStream out(&settingsFile);
-            out << "NICKNAME:" << userData.nickname << "\n";
-            out << "BIO:" << userData.bio << "\n";
-            out << "ONLINE:" << (userData.isOnline ? "true" : "false") << "\n";
+        QString userId = UserIds::getInstance()->idOf(userIt.key());
+        saveUserContacts(userId);
+    }
 
-            // Save avatar path if available
-            if (!userData.avatarPath.isEmpty()) {
-                out << "AVATAR:" << userData.avatarPath << "\n";
-            }
+    credentialsDirty = false;
+    dirtySettings.clear();
+    dirtyUserFiles.clear();
+    qDebug() << "All data saved successfully.";
+}
 
-            settingsFile.close();
-            qDebug() << "Saved settings for user:" << email;
-        } else {
-            qDebug() << "Failed to save settings for user:" << email;
+void server::saveUserSettingsFile(const QString &email) {
+    auto it = userMap.constFind(email);
+    if (it == userMap.constEnd()) {
+        return;
+    }
+    const UserData &userData = it.value();
+
+    QString settingsPath = "../db/settings/" + email + "_settings.txt";
+    QFile settingsFile(settingsPath);
+
+    if (settingsFile.open(QIODevice::WriteOnly | QIODevice::Text)) {
+        QTextStream out(&settingsFile);
+        out << "NICKNAME:" << userData.nickname << "\n";
+        out << "BIO:" << userData.bio << "\n";
+        out << "ONLINE:" << (userData.isOnline ? "true" : "false") << "\n";
+        if (userData.lastStatusChange.isValid()) {
+            out << "LAST_CHANGE:" << userData.lastStatusChange.toString(Qt::ISODate) << "\n";
+        }
+
+        // Save avatar path if available
+        if (!userData.avatarPath.isEmpty()) {
+            out << "AVATAR:" << userData.avatarPath << "\n";
         }
+
+        settingsFile.close();
+        dirtySettings.remove(email);
+        pendingPresenceWrites.remove(email);
+        qDebug() << "Saved settings for user:" << email;
+    } else {
+        qDebug() << "Failed to save settings for user:" << email;
     }
+}
 
-    // Save room messages
-    QMapIterator<QString, QList<Message>> roomIt(roomMessages);
-    while (roomIt.hasNext()) {
-        roomIt.next();
+// Write only what changed during this session. Most mutations persist their
+// own file right away; this catches the ones that only touched memory.
+void server::saveChangedData() {
+    int written = 0;
 
-        QString roomId = roomIt.key();
-        const QList<Message> &messages = roomIt.value();
+    if (credentialsDirty) {
+        saveUsersAccounts();
+        ++written;
+    }
 
-        QFile file("../db/rooms/" + roomId + ".txt");
-        if (file.open(QIODevice::WriteOnly | QIODevice::Text)) {
-            QTextStream out(&file);
-            
-            // Write messages in chronological order
-            for (const Message &msg : messages) {
-                out << msg.toString() << "\n";
-            }
+    const QSet<QString> settings = dirtySettings;
+    for (const QString &email : settings) {
+        saveUserSettingsFile(email);
+        ++written;
+    }
 
-            file.close();
-            qDebug() << "Saved" << messages.size() << "messages for room" << roomId;
-        } else {
-            qDebug() << "Failed to save messages for room" << roomId;
+    for (const RoomLogPtr &log : roomLogs.allLogs()) {
+        if (log->saveIfDirty()) {
+            ++written;
         }
     }
 
-    // Save user data (contacts, rooms)
-    QMapIterator<QString, QVector<QString>> userIt(userContacts);
-    while (userIt.hasNext()) {
-        userIt.next();
-
-        QString userId = userIt.key();
+    const QSet<QString> userFiles = dirtyUserFiles;
+    for (const QString &userId : userFiles) {
         saveUserContacts(userId);
+        ++written;
     }
 
-    qDebug() << "All data saved successfully.";
+    written += dirtyRoomMeta.size();
+    flushRoomMeta();
+
+    qDebug() << "Saved" << written << "changed files.";
 }
 
 void server::loadUsersAccounts() {
@@ -259,7 +352,7 @@ void server::loadUsersAccounts() {
         QString line = in.readLine();
         QStringList parts = line.split(',');
         if (parts.size() >= 3) {
-            QString email = parts[0].trimmed();
+            QString email = normalizeUserId(parts[0]);
             QString username = parts[1].trimmed();
             QString password = parts[2].trimmed();
 
@@ -312,15 +405,18 @@ void server::loadUserContacts(const QString &userId) {
                 }
             } else if (line.startsWith("NICKNAME:")) {
                 QString nickname = line.mid(9).trimmed();
-                if (userMap.contains(userId)) {
+                // Usually already loaded with the credentials: nothing to sync
+                if (userMap.contains(userId) && userMap[userId].nickname != nickname) {
                     userMap[userId].nickname = nickname;
+                    syncUserIndexes(userId);
                     qDebug()
                         << "Loaded nickname for" << userId << ":" << nickname;
                 }
             } else if (line.startsWith("BIO:")) {
                 QString bio = line.mid(4).trimmed();
-                if (userMap.contains(userId)) {
+                if (userMap.contains(userId) && userMap[userId].bio != bio) {
                     userMap[userId].bio = bio;
+                    syncUserIndexes(userId);
                     qDebug() << "Loaded bio for" << userId << ":" << bio;
                 }
             }
@@ -329,49 +425,125 @@ void server::loadUserContacts(const QString &userId) {
         file.close();
     }
 
-    userContacts[userId] = contacts;
-    userRooms[userId] = rooms;
+    setContacts(userId, contacts);
+    dropUserRooms(userHandle(userId));
+    userRooms[userHandle(userId)] = rooms;
+}
 
-    // Also load blocked users if available
+void server::loadBlockedUsers(const QString &userId) {
+    // The file is a delta log: "+user" blocks, "-user" unblocks, and a bare
+    // line (the original format, and what compaction writes) blocks
     QString blockedPath = "../db/users/" + userId + "_blocked.txt";
     QFile blockedFile(blockedPath);
 
     if (blockedFile.exists() &&
         blockedFile.open(QIODevice::ReadOnly | QIODevice::Text)) {
-        QVector<QString> blocked;
+        UserHandle user = userHandle(userId);
+        int lines = 0;
         QTextStream in(&blockedFile);
 
         while (!in.atEnd()) {
             QString line = in.readLine().trimmed();
-            if (!line.isEmpty()) {
-                blocked.append(line);
-                qDebug() << "Loaded blocked user for" << userId << ":" << line;
+            if (line.isEmpty()) {
+                continue;
+            }
+            ++lines;
+            if (line.startsWith('-')) {
+                social.remove(SocialGraph::Block, user, userHandle(line.mid(1)));
+            } else {
+                social.add(SocialGraph::Block, user,
+                           userHandle(line.startsWith('+') ? line.mid(1) : line));
             }
         }
 
         blockedFile.close();
-        blockedUsers[userId] = blocked;
+        blockFileLines[user] = lines;
+        republishBlocks(user);
+
+        // Mostly cancelled-out deltas: rewrite as the current list
+        if (lines > 2 * social.degree(SocialGraph::Block, user) + BLOCK_FILE_SLACK) {
+            compactBlockFile(userId);
+        }
+    }
+}
+
+void server::setContacts(const QString &userId, const QVector<QString> &contacts) {
+    userContacts[userHandle(userId)] = contacts;
+    QVector<UserHandle> handles;
+    handles.reserve(contacts.size());
+    for (const QString &contactId : contacts) {
+        handles.append(userHandle(contactId));
+    }
+    social.replace(SocialGraph::Contact, userHandle(userId), handles);
+}
+
+void server::appendBlockDelta(const QString &userId, QChar op, const QString &otherId) {
+    UserHandle user = userHandle(userId);
+    int &lines = blockFileLines[user];
+    ++lines;
+    if (lines > 2 * social.degree(SocialGraph::Block, user) + BLOCK_FILE_SLACK) {
+        compactBlockFile(userId);
+        return;
     }
+
+    // One short append instead of rewriting the list; pinned to the user so
+    // their deltas reach the file in order
+    QString path = "../db/users/" + userId + "_blocked.txt";
+    QString line = QString(op) + otherId;
+    jobs.submit([path, line]() {
+        QFile file(path);
+        if (file.open(QIODevice::WriteOnly | QIODevice::Append | QIODevice::Text)) {
+            QTextStream out(&file);
+            out << line << "\n";
+            file.close();
+        } else {
+            qDebug() << "Failed to append to" << path << ":" << file.errorString();
+        }
+    }, TaskPool::Background, int(user));
+}
+
+void server::compactBlockFile(const QString &userId) {
+    UserHandle user = userHandle(userId);
+    UserIds *ids = UserIds::getInstance();
+    QString contents;
+    const QVector<UserHandle> blocked = social.targets(SocialGraph::Block, user);
+    for (UserHandle other : blocked) {
+        contents += ids->idOf(other) + "\n";
+    }
+    blockFileLines[user] = blocked.size();
+
+    QString path = "../db/users/" + userId + "_blocked.txt";
+    jobs.submit([path, contents]() {
+        QFile file(path);
+        if (file.open(QIODevice::WriteOnly | QIODevice::Text)) {
+            QTextStream out(&file);
+            out << contents;
+            file.close();
+        } else {
+            qDebug() << "Failed to rewrite" << path << ":" << file.errorString();
+        }
+    }, TaskPool::Background, int(user));
 }
 
 void server::saveUserContacts(const QString &userId) {
     QString filename = "../db/users/" + userId + ".txt";
     QFile file(filename);
+    UserHandle user = findUserHandle(userId);
 
     if (file.open(QIODevice::WriteOnly | QIODevice::Text)) {
         QTextStream out(&file);
 
         // Save contacts
-        if (userContacts.contains(userId)) {
-            const QVector<QString> &contacts = userContacts[userId];
+        if (userContacts.contains(user)) {
+            const QVector<QString> &contacts = userContacts[user];
             for (const QString &contactId : contacts) {
                 out << "CONTACT:" << contactId << "\n";
             }
         }
 
         // Save rooms
-        if (userRooms.contains(userId)) {
-            const QMap<QString, Room *> &rooms = userRooms[userId];
+        if (userRooms.contains(user)) {
+            const QMap<QString, Room *> &rooms = userRooms[user];
             QMapIterator<QString, Room *> i(rooms);
             while (i.hasNext()) {
                 i.next();
@@ -392,6 +564,7 @@ void server::saveUserContacts(const QString &userId) {
         }
 
         file.close();
+        dirtyUserFiles.remove(userId);
         qDebug() << "Saved user data for" << userId;
     } else {
         qDebug() << "Failed to save user data for" << userId << ":"
@@ -399,7 +572,8 @@ void server::saveUserContacts(const QString &userId) {
     }
 }
 
-bool server::checkUser(const QString &email, const QString &password) {
+bool server::checkUser(const QString &rawEmail, const QString &password) {
+    QString email = normalizeUserId(rawEmail);
     if (!isValidEmail(email)) {
         return false;
     }
@@ -422,6 +596,9 @@ void server::addUser(const QString &email, const QString &password) {
     userData.lastStatusChange = QDateTime::currentDateTime();
 
     userMap.insert(email, userData);
+    syncUserIndexes(email);
+    credentialsDirty = true;
+    dirtySettings.insert(email);
 }
 
 bool server::isValidEmail(const QString &email) {
@@ -435,10 +612,12 @@ bool server::isValidPassword(const QString &password) {
     return password.length() >= 4;
 }
 
-bool server::registerUser(const QString &username, const QString &email,
+bool server::registerUser(const QString &username, const QString &rawEmail,
                           const QString &password,
                           const QString &confirmPassword,
                           QString &errorMessage) {
+    QString email = normalizeUserId(rawEmail);
+
     // Validate email format
     if (!isValidEmail(email)) {
         errorMessage =
@@ -483,6 +662,7 @@ bool server::registerUser(const QString &username, const QString &email,
 
     // Add user to in-memory map
     userMap.insert(email, userData);
+    syncUserIndexes(email);
 
     // Save to credentials file immediately
     saveUsersAccounts();
@@ -503,9 +683,11 @@ bool server::registerUser(const QString &username, const QString &email,
     return true;
 }
 
-bool server::resetPassword(const QString &email, const QString &newPassword,
+bool server::resetPassword(const QString &rawEmail, const QString &newPassword,
                            const QString &confirmPassword,
                            QString &errorMessage) {
+    QString email = normalizeUserId(rawEmail);
+
     // Check if email exists
     if (!isValidEmail(email)) {
         errorMessage =
@@ -534,26 +716,58 @@ bool server::resetPassword(const QString &email, const QString &newPassword,
 
     // Update the password
     userMap[email].password = newPassword;
+    credentialsDirty = true;
     return true;
 }
 
-QVector<QPair<QString, QString>> server::getAllUsers() const {
+QVector<QPair<QString, QString>> server::listUsers(const QString &cursor, int limit,
+                                                   QString *nextCursor) const {
     QVector<QPair<QString, QString>> users;
-    QMapIterator<QString, UserData> i(userMap);
-    while (i.hasNext()) {
-        i.next();
-        users.append(qMakePair(i.key(), i.value().nickname));
+    if (nextCursor) {
+        nextCursor->clear();
+    }
+    if (limit <= 0) {
+        return users;
+    }
+
+    // userMap is ordered by email, so a page is a seek plus limit steps
+    auto it = cursor.isEmpty() ? userMap.constBegin() : userMap.upperBound(cursor);
+    users.reserve(limit);
+    for (; it != userMap.constEnd() && users.size() < limit; ++it) {
+        users.append(qMakePair(it.key(), it.value().nickname));
+    }
+    if (nextCursor && it != userMap.constEnd() && !users.isEmpty()) {
+        *nextCursor = users.last().first;
+    }
+    return users;
+}
+
+QVector<QPair<QString, QString>> server::lookupUsers(const QVector<QString> &userIds) const {
+    QVector<QPair<QString, QString>> users;
+    users.reserve(userIds.size());
+    for (const QString &userId : userIds) {
+        auto it = userMap.constFind(userId);
+        if (it != userMap.constEnd()) {
+            users.append(qMakePair(it.key(), it.value().nickname));
+        }
     }
     return users;
 }
 
-Client *server::loginUser(const QString &email, const QString &password) {
+Client *server::loginUser(const QString &rawEmail, const QString &password) {
+    QString email = normalizeUserId(rawEmail);
     if (!checkUser(email, password)) {
         return nullptr;
     }
 
-    // Read current online status before doing anything else
+    // Bring in this user's contacts, rooms and inbox on first login
+    hydrateUser(email);
+
+    // A user who chose to appear online is online from their first heartbeat
     bool wasOnline = userMap[email].isOnline;
+    if (wasOnline) {
+        heartbeat(email);
+    }
 
     // Create new client if doesn't exist
     if (!clients.contains(email)) {
@@ -566,6 +780,8 @@ Client *server::loginUser(const QString &email, const QString &password) {
     }
 
     currentClient = clients[email];
+    clientLastActive[email] = QDateTime::currentMSecsSinceEpoch();
+    enforceMemoryBudget();
 
     // Preserve the previous online status instead of forcing offline
     qDebug() << "User" << email << "logged in with status preserved as"
@@ -588,7 +804,11 @@ void server::logoutUser() {
         // Save client data
         saveClientData(currentClient);
 
-        // Clear currentClient without changing online status
+        // The session is over, so presence ends now rather than at TTL expiry;
+        // the user's "appear online" choice is kept for their next login
+        presence.goOffline(userHandle(userId), QDateTime::currentMSecsSinceEpoch());
+        presence.dropInterests(userHandle(userId));
+        applyPresenceChanges();
         currentClient = nullptr;
 
         qDebug() << "User" << userId << "logged out. Status preserved as"
@@ -602,34 +822,9 @@ void server::loadClientData(Client *client) {
 
     QString userId = client->getUserId();
 
-    // Load client data from our in-memory structures
-    if (userContacts.contains(userId)) {
-        // Add contacts
-        const QVector<QString> &contacts = userContacts[userId];
-        for (const QString &contactId : contacts) {
-            client->addContact(contactId);
-        }
-    }
-
-    // Load rooms
-    if (userRooms.contains(userId)) {
-        const QMap<QString, Room *> &rooms = userRooms[userId];
-        QMapIterator<QString, Room *> i(rooms);
-        while (i.hasNext()) {
-            i.next();
-            Room *room = i.value();
-
-            // Add room to client
-            client->addRoom(room);
-
-            // Add messages to room
-            if (roomMessages.contains(room->getRoomId())) {
-                const QList<Message> &messages =
-                    roomMessages[room->getRoomId()];
-                room->setMessages(messages);
-            }
-        }
-    }
+    // Hand the client the data hydrated at login instead of having it
+    // re-read the user file; rooms view the shared room logs
+    client->hydrate(userContacts.value(userHandle(userId)), userRooms.value(userHandle(userId)).values());
 }
 
 void server::saveClientData(Client *client) {
@@ -640,21 +835,35 @@ void server::saveClientData(Client *client) {
 
     // Save contacts
     QVector<QString> contacts = client->getContacts();
-    userContacts[userId] = contacts;
+    if (userContacts.value(userHandle(userId)) != contacts) {
+        setContacts(userId, contacts);
+        dirtyUserFiles.insert(userId);
+    }
 
     // Save rooms
     QMap<QString, Room *> rooms;
+    QSet<Room *> kept;
     QVector<Room *> clientRooms = client->getAllRooms();
 
     for (Room *room : clientRooms) {
+        // Messages already live in the shared room log
         rooms[room->getRoomId()] = room;
+        kept.insert(room);
+    }
 
-        // Save room messages
-        const QList<Message> &messages = room->getMessages();
-        roomMessages[room->getRoomId()] = messages;
+    // userRooms owns the Room objects: rooms the client opened become the
+    // server's here, and rooms it dropped are freed
+    const QMap<QString, Room *> previous = userRooms.value(userHandle(userId));
+    for (Room *room : previous) {
+        if (!kept.contains(room)) {
+            delete room;
+        }
     }
 
-    userRooms[userId] = rooms;
+    if (previous.keys() != rooms.keys()) {
+        dirtyUserFiles.insert(userId);
+    }
+    userRooms[userHandle(userId)] = rooms;
 }
 
 void server::saveAllClientsData() {
@@ -681,27 +890,46 @@ bool server::deleteUser(const QString &userId) {
             currentClient = nullptr;
         }
 
-        // Delete the client object
+        // Hand its rooms to userRooms, which frees them below; the client
+        // itself only views them
+        saveClientData(clientToDelete);
         delete clientToDelete;
         clients.remove(userId);
     }
 
     // Remove all user data from in-memory structures
     userMap.remove(userId);
-    userContacts.remove(userId);
+    syncUserIndexes(userId);
+    credentialsDirty = true;
+    dirtySettings.remove(userId);
+    dirtyUserFiles.remove(userId);
+    hydratedUsers.remove(userId);
+    UserHandle handle = findUserHandle(userId);
+    userContacts.remove(handle);
+    social.removeUser(handle);
+    // The user may be in anyone's block set; account deletion is rare
+    const QList<UserHandle> blockers = publishedBlocks.keys();
+    for (UserHandle blocker : blockers) {
+        republishBlocks(blocker);
+    }
+    publishReadState();
+    userInbox.remove(handle);
+    userRecent.remove(handle);
 
     // Remove rooms associated with this user and their messages
-    if (userRooms.contains(userId)) {
-        QMap<QString, Room *> &rooms = userRooms[userId];
+    if (userRooms.contains(handle)) {
+        QMap<QString, Room *> &rooms = userRooms[handle];
         QMapIterator<QString, Room *> i(rooms);
         while (i.hasNext()) {
             i.next();
             QString roomId = i.key();
             delete i.value();            // Delete Room object
-            roomMessages.remove(roomId); // Remove messages
+            roomLogs.remove(roomId);     // Drop the shared log
+            roomReadMarks.remove(UserIds::getInstance()->findRoomKeyForRoomId(roomId));
+            dirtyRoomMeta.remove(roomId);
         }
 
-        userRooms.remove(userId);
+        userRooms.remove(handle);
     }
 
     qDebug() << "User" << userId << "deleted successfully";
@@ -720,6 +948,7 @@ bool server::updateUserSettings(const QString &userId, const QString &nickname,
 
     userMap[userId].nickname = nickname;
     userMap[userId].bio = bio;
+    syncUserIndexes(userId);
 
     // Save settings immediately to ensure persistence
     QString settingsPath = "../db/settings/" + userId + "_settings.txt";
@@ -756,22 +985,18 @@ bool server::getUserSettings(const QString &userId, QString &nickname,
 
 bool server::getUserSettings(const QString &userId, QString &nickname,
                              QString &bio, QString &avatarPath) {
-    qDebug() << "Getting settings for user ID:" << userId;
-    
-    if (!userMap.contains(userId)) {
+    // Called for every row on every refresh, so it reads the published
+    // snapshot and stays quiet on success
+    ReadSnapshot state = readState();
+    const UserProfile *profile = state->profile(userId);
+    if (!profile) {
         qDebug() << "ERROR: User" << userId << "not found in user map";
         return false;
     }
 
-    nickname = userMap[userId].nickname;
-    bio = userMap[userId].bio;
-    avatarPath = userMap[userId].avatarPath;
-
-    qDebug() << "Retrieved settings - User:" << userId 
-             << "Nickname:" << nickname 
-             << "Bio:" << (bio.isEmpty() ? "[empty]" : "[set]")
-             << "Avatar:" << (avatarPath.isEmpty() ? "[none]" : avatarPath);
-    
+    nickname = profile->nickname;
+    bio = profile->bio;
+    avatarPath = profile->avatarPath;
     return true;
 }
 
@@ -781,62 +1006,159 @@ bool server::setUserOnlineStatus(const QString &userId, bool isOnline) {
         return false;
     }
 
-    // Save the current avatar path before updating status
-    QString avatarPath = userMap[userId].avatarPath;
-
-    // Only update if status actually changes
+    // Remember the user's choice; it is persisted with the next batch
     if (userMap[userId].isOnline != isOnline) {
         userMap[userId].isOnline = isOnline;
-        userMap[userId].lastStatusChange = QDateTime::currentDateTime();
-        qDebug() << "Set user" << userId << "online status to"
-                 << (isOnline ? "online" : "offline") << "at"
-                 << userMap[userId].lastStatusChange.toString();
+        dirtySettings.insert(userId);
     }
 
-    // Immediately save the settings to ensure persistence
-    QString settingsPath = "../db/settings/" + userId + "_settings.txt";
-    QFile settingsFile(settingsPath);
+    // Presence itself is in memory only
+    qint64 now = QDateTime::currentMSecsSinceEpoch();
+    if (isOnline) {
+        presence.heartbeat(userHandle(userId), now);
+    } else {
+        presence.goOffline(userHandle(userId), now);
+    }
+    applyPresenceChanges();
 
-    if (settingsFile.open(QIODevice::WriteOnly | QIODevice::Text)) {
-        QTextStream out(&settingsFile);
-        out << "NICKNAME:" << userMap[userId].nickname << "\n";
-        out << "BIO:" << userMap[userId].bio << "\n";
-        out << "ONLINE:" << (isOnline ? "true" : "false") << "\n";
-        out << "LAST_CHANGE:"
-            << userMap[userId].lastStatusChange.toString(Qt::ISODate) << "\n";
+    qDebug() << "Set user" << userId << "online status to"
+             << (isOnline ? "online" : "offline");
+    return true;
+}
 
-        // Preserve the avatar path in the settings file
-        if (!avatarPath.isEmpty()) {
-            out << "AVATAR:" << avatarPath << "\n";
+bool server::isUserOnline(const QString &userId) const {
+    const UserProfile *profile = profiles.find(userId);
+    return profile && presence.isOnline(profile->handle, QDateTime::currentMSecsSinceEpoch());
+}
+
+void server::heartbeat(const QString &userId) {
+    auto it = userMap.constFind(userId);
+    if (it == userMap.constEnd() || !it.value().isOnline) {
+        return; // Unknown user, or one who chose to appear offline
+    }
+    qint64 now = QDateTime::currentMSecsSinceEpoch();
+    presence.heartbeat(userHandle(userId), now);
+    presence.advance(now);
+    applyPresenceChanges();
+}
+
+void server::tickPresence() {
+    qint64 now = QDateTime::currentMSecsSinceEpoch();
+    presence.advance(now);
+    applyPresenceChanges();
+    typing.sweep(now);
+    profiles.maintain(); // Swap in a finished profile snapshot, if any
+    applyPendingMutations(); // In case no event loop delivered them
+
+    if (now - lastStoryExpiryMs >= STORY_EXPIRY_CHECK_MS) {
+        lastStoryExpiryMs = now;
+        cleanupOldStories();
+    }
+
+    // Write the accumulated status-change times in one batch
+    if (!pendingPresenceWrites.isEmpty() &&
+        now - lastPresenceFlushMs >= PRESENCE_FLUSH_INTERVAL_MS) {
+        const QSet<QString> pending = pendingPresenceWrites;
+        for (const QString &userId : pending) {
+            saveUserSettingsFile(userId);
         }
+        pendingPresenceWrites.clear();
+        lastPresenceFlushMs = now;
+        qDebug() << "Flushed presence times for" << pending.size() << "users";
+    }
 
-        settingsFile.close();
-        qDebug() << "Saved online status for user:" << userId
-                 << "with avatar path:"
-                 << (!avatarPath.isEmpty() ? avatarPath : "none");
+    if (!dirtyRoomMeta.isEmpty() && now - lastRoomMetaFlushMs >= ROOM_META_FLUSH_INTERVAL_MS) {
+        flushRoomMeta();
+        lastRoomMetaFlushMs = now;
     }
+}
 
-    return true;
+void server::setPresenceInterests(const QString &watcherId, const QVector<QString> &userIds) {
+    UserHandle watcher = userHandle(watcherId);
+    QVector<UserHandle> targets;
+    targets.reserve(userIds.size());
+    for (const QString &userId : userIds) {
+        // Presence does not flow between users who blocked each other
+        UserHandle target = userHandle(userId);
+        if (!social.blockedEitherWay(watcher, target)) {
+            targets.append(target);
+        }
+    }
+    presence.setInterests(watcher, targets, QDateTime::currentMSecsSinceEpoch());
 }
 
-bool server::isUserOnline(const QString &userId) const {
-    if (!userMap.contains(userId)) {
+QHash<QString, bool> server::takePresenceUpdates(const QString &watcherId) {
+    QHash<QString, bool> updates;
+    UserHandle watcher = findUserHandle(watcherId);
+    if (watcher == 0) {
+        return updates;
+    }
+    UserIds *ids = UserIds::getInstance();
+    for (const PresenceEngine::Change &change : presence.takeUpdates(watcher)) {
+        updates.insert(ids->idOf(change.user), change.online);
+    }
+    return updates;
+}
+
+bool server::setTyping(const QString &userId, const QString &peerId, bool isTyping) {
+    RoomKey key = UserIds::roomKey(userHandle(userId), userHandle(peerId));
+    if (!isTyping) {
+        typing.clear(key, userHandle(userId));
+        return true;
+    }
+    return typing.publish(key, userHandle(userId), QDateTime::currentMSecsSinceEpoch());
+}
+
+bool server::isUserTyping(const QString &typerId, const QString &peerId) const {
+    UserHandle typer = findUserHandle(typerId);
+    UserHandle peer = findUserHandle(peerId);
+    if (typer == 0 || peer == 0 || social.blockedEitherWay(typer, peer)) {
         return false;
     }
+    return typing.isActive(UserIds::roomKey(typer, peer), typer,
+                           QDateTime::currentMSecsSinceEpoch());
+}
 
-    return userMap[userId].isOnline;
+void server::applyPresenceChanges() {
+    UserIds *ids = UserIds::getInstance();
+    for (const PresenceEngine::Change &change : presence.takeChanges()) {
+        QString userId = ids->idOf(change.user);
+        auto it = userMap.find(userId);
+        if (it == userMap.end()) {
+            continue;
+        }
+        it.value().lastStatusChange = QDateTime::fromMSecsSinceEpoch(change.atMs);
+        pendingPresenceWrites.insert(userId);
+        dirtySettings.insert(userId); // Written at shutdown if no batch ran
+    }
 }
 
 server::~server() {
-    // Save all data before shutting down
-    saveAllData();
+    // Finish queued appends and apply their bookkeeping first, so only logs
+    // whose lines did not reach the disk are rewritten below
+    roomShards.drainAll();
+    applyPendingMutations();
+
+    // Save whatever changed this session before shutting down
+    saveChangedData();
+
+    qDebug().noquote() << postLatencyReport();
+
+    // Let the shards finish their writes before the hook goes away
+    roomShards.drainAll();
+    roomLogs.setFileBarrier(nullptr);
 
-    // Clean up clients
+    // Clean up clients, then the rooms they viewed
+    saveAllClientsData();
     for (Client *client : clients) {
         delete client;
     }
     clients.clear();
     currentClient = nullptr;
+    for (const QMap<QString, Room *> &rooms : userRooms) {
+        qDeleteAll(rooms);
+    }
+    userRooms.clear();
 }
 
 // Migrate inconsistent room files (unchanged)
@@ -873,16 +1195,13 @@ void server::migrateRoomFiles() {
             continue;
         }
 
-        QStringList users = roomId.split("_");
-        if (users.size() != 2) {
+        // Normalize users to emails for consistent matching
+        QString user1, user2;
+        if (!Room::splitRoomId(roomId, user1, user2)) {
             problemFiles << roomId;
             continue;
         }
 
-        // Normalize users to emails for consistent matching
-        QString user1 = users[0];
-        QString user2 = users[1];
-
         // We must use the exact user IDs without any transformation
         // Email addresses should already be used properly from other fixes
 
@@ -993,10 +1312,8 @@ void server::migrateRoomFiles() {
                     QString roomName = parts[1];
 
                     // Check if this room ID needs normalization
-                    QStringList users = roomName.split("_");
-                    if (users.size() == 2) {
-                        QString user1 = users[0];
-                        QString user2 = users[1];
+                    QString user1, user2;
+                    if (Room::splitRoomId(roomName, user1, user2)) {
 
                         // Use the exact user IDs without any transformation
 
@@ -1080,6 +1397,7 @@ void server::saveUsersAccounts() {
     }
 
     file.close();
+    credentialsDirty = false;
     qDebug() << "Total users saved:" << userMap.size();
 }
 
@@ -1132,136 +1450,555 @@ void server::createDefaultSettingsFiles() {
     qDebug() << "Created" << filesCreated << "default settings files.";
 }
 
-// Update the updateRoomMessages method to use QList
+// Replace a room's whole history (edits and repairs; sends use postMessage)
 void server::updateRoomMessages(const QString &roomId,
                                 const QVector<Message> &messages) {
-    // Convert QVector to QList
-    setMessageListFromVector(roomId, messages);
+    hydrateRoom(roomId);
+    roomLogs.acquire(roomId)->replaceAll(messages);
+    dropMessageIndexes(roomId);
+    refreshInboxForRoom(roomId);
     qDebug() << "Updated in-memory messages for room:" << roomId << "with"
              << messages.size() << "messages";
 }
 
-// Update the getRoomMessages method to convert from QList to QVector
-QVector<Message> server::getRoomMessages(const QString &roomId) const {
-    return getMessageVectorFromList(roomId);
-}
-
-// New methods for QList implementation
+bool server::editMessage(const QString &roomId, quint64 seq, const QString &content) {
+    hydrateRoom(roomId);
+    RoomLogPtr log = roomLogs.acquire(roomId);
+    if (!log->updateContent(seq, content)) {
+        qDebug() << "No message" << seq << "to edit in room" << roomId;
+        return false;
+    }
+    log->save();
 
-// Add a message to a room's message list
-void server::addMessageToRoom(const QString &roomId, const Message &message) {
-    roomMessages[roomId].append(message);
-    qDebug() << "Added new message to room:" << roomId;
+    // Posting lists are append-only, so the old words cannot be taken out:
+    // both participants' indexes are rebuilt on their next search
+    dropMessageIndexes(roomId);
+    refreshInboxForRoom(roomId);
+    qDebug() << "Edited message" << seq << "in room" << roomId;
+    return true;
 }
 
-// Convert a message list to a vector (for compatibility with existing code)
-QVector<Message> server::getMessageVectorFromList(const QString &roomId) const {
-    if (!roomMessages.contains(roomId)) {
+// Implicitly shared, so this does not copy the messages
+QVector<Message> server::getRoomMessages(const QString &roomId) const {
+    RoomLogPtr log = roomLogs.find(roomId);
+    if (!log) {
         return QVector<Message>();
     }
-    
-    QVector<Message> messageVector;
-    
-    // Copy messages from list to vector (already in chronological order)
-    for (const Message &msg : roomMessages[roomId]) {
-        messageVector.append(msg);
-    }
-    
-    return messageVector;
+    log->ensureLoaded();
+    return log->getMessages();
 }
 
-// Set a room's message list from a vector
-void server::setMessageListFromVector(const QString &roomId, const QVector<Message> &messages) {
-    QList<Message> messageList;
-    
-    // Add messages to list (already in chronological order)
-    for (const Message &msg : messages) {
-        messageList.append(msg);
-    }
-    
-    roomMessages[roomId] = messageList;
+// Append a message to the room's shared log and its file; O(1) per send
+PostResult server::postMessage(const QString &senderId, const QString &recipientId,
+                               const QString &body) {
+    PostResult result;
+    QElapsedTimer total;
+    QElapsedTimer stage;
+    total.start();
+    stage.start();
+
+    // Validate
+    if (body.isEmpty()) {
+        result.status = PostResult::EmptyBody;
+    } else if (!userMap.contains(senderId)) {
+        result.status = PostResult::UnknownSender;
+    } else if (!userMap.contains(recipientId) || recipientId == senderId) {
+        result.status = PostResult::UnknownRecipient;
+    } else if (social.blockedEitherWay(findUserHandle(senderId), findUserHandle(recipientId))) {
+        result.status = PostResult::Blocked;
+    }
+    recordStage(PostValidate, stage);
+    if (!result.ok()) {
+        qDebug() << "Rejected message from" << senderId << "to" << recipientId
+                 << "- status" << result.status;
+        return result;
+    }
+
+    // Sequence: find or create the room, then append (persist and index
+    // follow inside storeMessage)
+    Room *senderRoom = resolveRoomForPost(senderId, recipientId, result.roomId);
+    if (result.roomId.isEmpty()) {
+        result.status = PostResult::NoRoom;
+        recordStage(PostSequence, stage);
+        return result;
+    }
+    Message message(body, senderId);
+    bool recipientOnline = isUserOnline(recipientId);
+    result.seq = storeMessage(result.roomId, message, stage);
+
+    // Fan-out
+    fanOutMessage(result.roomId, senderId, result.seq);
+    if (senderRoom) {
+        senderRoom->updateLastActivity();
+    }
+    // An online recipient sees the message immediately
+    if (recipientOnline) {
+        markRoomRead(result.roomId, recipientId, result.seq);
+    }
+    if (clients.contains(recipientId)) {
+        mirrorRoomForRecipient(recipientId, senderId, result.roomId,
+                               senderRoom ? senderRoom->getName() : result.roomId);
+    }
+    recordStage(PostFanOut, stage);
+
+    notifyMessage(result.roomId, senderId);
+    recordStage(PostNotify, stage);
+    recordStage(PostTotal, total);
+
+    qDebug() << "Posted message" << result.seq << "from" << senderId << "to" << recipientId
+             << "in room" << result.roomId;
+    return result;
 }
 
-bool server::addContactForUser(const QString &userId,
-                               const QString &contactId) {
-    if (!userMap.contains(userId)) {
-        qDebug() << "User" << userId << "not found for adding contact";
-        return false;
-    }
+void server::recordStage(PostStage stage, QElapsedTimer &timer) {
+    postStageLatency[stage].record(timer.nsecsElapsed());
+    timer.start();
+}
 
-    // Create contacts vector if it doesn't exist
-    if (!userContacts.contains(userId)) {
-        userContacts[userId] = QVector<QString>();
-    }
+// Sequence, persist and index stages
+quint64 server::storeMessage(const QString &roomId, const Message &message,
+                             QElapsedTimer &stage) {
+    hydrateRoom(roomId);
+    RoomLogPtr log = roomLogs.acquire(roomId);
+    quint64 seq = log->append(message);
+    recordStage(PostSequence, stage);
+
+    // The line is built here; the room's shard does the file write, so a
+    // busy room's disk I/O neither blocks this thread nor queues behind
+    // rooms on other shards
+    QString roomIdCopy = roomId;
+    QString line = log->at(log->size() - 1).toString();
+    quint64 appendedVersion = log->getVersion();
+    QWeakPointer<RoomLog> weakLog = log;
+    roomShards.post(UserIds::getInstance()->findRoomKeyForRoomId(roomId),
+                    [this, roomIdCopy, line, weakLog, appendedVersion]() {
+        if (!RoomLog::appendLine(roomIdCopy, line)) {
+            return; // The log stays dirty, so the next save rewrites the file
+        }
+        // Only a written line may mark the log clean, and only the owner
+        // touches the log
+        postMutation([weakLog, appendedVersion]() {
+            RoomLogPtr written = weakLog.toStrongRef();
+            if (written) {
+                written->markAppended(appendedVersion);
+            }
+        });
+    });
+    recordStage(PostPersist, stage);
 
-    // Add the contact if it's not already there
-    if (!userContacts[userId].contains(contactId)) {
-        userContacts[userId].append(contactId);
+    indexMessage(roomId, seq, message.getContent());
+    recordStage(PostIndex, stage);
+    return seq;
+}
 
-        // Save to disk immediately
-        saveUserContacts(userId);
-        qDebug() << "Added contact" << contactId << "for user" << userId;
-        return true;
-    }
+void server::fanOutMessage(const QString &roomId, const QString &senderId, quint64 seq) {
+    // The sender has read everything up to their own message
+    markRoomRead(roomId, senderId, seq);
+    refreshInboxForRoom(roomId);
+}
 
-    return false; // Contact already existed
+void server::notifyMessage(const QString &roomId, const QString &senderId) {
+    // A sent message ends the sender's typing indicator
+    typing.clear(UserIds::getInstance()->findRoomKeyForRoomId(roomId), userHandle(senderId));
+    if (clients.contains(senderId)) {
+        clientLastActive[senderId] = QDateTime::currentMSecsSinceEpoch();
+    }
+    if (++operationsSinceTrim >= TRIM_INTERVAL) {
+        enforceMemoryBudget();
+    }
+    if (++postsSinceReport >= POST_REPORT_INTERVAL) {
+        postsSinceReport = 0;
+        qDebug().noquote() << postLatencyReport();
+    }
 }
 
-bool server::hasContactForUser(const QString &userId,
-                               const QString &contactId) {
-    if (!userContacts.contains(userId)) {
-        return false;
+Room *server::resolveRoomForPost(const QString &senderId, const QString &recipientId,
+                                 QString &roomId) {
+    // A signed-in sender gets the room (and the contact) created on first use
+    Client *client = clients.value(senderId, nullptr);
+    if (client) {
+        Room *room = client->getRoomWithUser(recipientId);
+        if (!room) {
+            qDebug() << "No existing room found, creating new room with user:" << recipientId;
+            room = client->createRoom(recipientId);
+        }
+        if (!client->hasContact(recipientId)) {
+            client->addContact(recipientId);
+        }
+        roomId = room ? room->getRoomId() : QString();
+        return room;
     }
 
-    return userContacts[userId].contains(contactId);
+    roomId = findRoomId(senderId, recipientId);
+    return nullptr;
 }
 
-bool server::addRoomToUser(const QString &userId, Room *room) {
-    if (!userMap.contains(userId) || !room) {
-        qDebug() << "User" << userId
-                 << "not found or invalid room for adding room";
-        return false;
+void server::mirrorRoomForRecipient(const QString &recipientId, const QString &senderId,
+                                    const QString &roomId, const QString &roomName) {
+    if (!hasContactForUser(recipientId, senderId)) {
+        addContactForUser(recipientId, senderId);
+        qDebug() << "Added" << senderId << "as contact for user" << recipientId;
     }
 
-    // Create rooms map if it doesn't exist
-    if (!userRooms.contains(userId)) {
-        userRooms[userId] = QMap<QString, Room *>();
+    Room *userRoom = nullptr;
+    if (hasRoomForUser(recipientId, roomId)) {
+        userRoom = userRooms.value(userHandle(recipientId)).value(roomId, nullptr);
+    } else {
+        userRoom = new Room(roomName);
+        userRoom->setRoomId(roomId);
+        if (!addRoomToUser(recipientId, userRoom)) {
+            delete userRoom; // userRooms did not take it
+            return;
+        }
+        qDebug() << "Added room to user" << recipientId;
     }
 
-    // Add the room if it's not already there
-    QString roomId = room->getRoomId();
-    if (!userRooms[userId].contains(roomId)) {
-        userRooms[userId][roomId] = room;
-
-        // Also ensure the messages are in the server's message store
-        roomMessages[roomId] = room->getMessages();
-
-        // Save to disk immediately
-        saveUserContacts(userId);
-        qDebug() << "Added room" << roomId << "for user" << userId;
-        return true;
+    // The recipient is signed in, so keep their Client object in step too;
+    // otherwise the next saveClientData would drop the room again
+    Client *targetClient = clients.value(recipientId, nullptr);
+    if (!targetClient) {
+        return;
+    }
+    if (!targetClient->hasContact(senderId)) {
+        targetClient->addContact(senderId);
+        qDebug() << "Added" << senderId << "as contact for logged in user" << recipientId;
+    }
+    Room *recipientRoom = targetClient->getRoom(roomId);
+    if (!recipientRoom) {
+        // The same Room object the server keeps for the user; it views the
+        // shared log
+        targetClient->addRoom(userRoom);
+        qDebug() << "Added room to logged in user" << recipientId;
+    } else {
+        recipientRoom->updateLastActivity();
     }
-
-    return false; // Room already existed
 }
 
-bool server::hasRoomForUser(const QString &userId, const QString &roomId) {
-    qDebug() << "Checking if user" << userId << "has room" << roomId;
-    
-    // First make sure the user exists in our data structure
-    if (!userRooms.contains(userId)) {
-        qDebug() << "User" << userId << "not found in userRooms map";
-        return false;
+QString server::postLatencyReport() const {
+    static const char *const names[POST_STAGE_COUNT] = {
+        "validate", "sequence", "persist", "index", "fan-out", "notify", "total"};
+    QString report = "Message post latency:";
+    for (int stage = 0; stage < POST_STAGE_COUNT; ++stage) {
+        report += QString("\n  %1: %2").arg(QString::fromLatin1(names[stage]), -9).arg(postStageLatency[stage].summary());
     }
-    
-    // Check if the room exists for this user
-    bool hasRoom = userRooms[userId].contains(roomId);
-    qDebug() << "Result:" << (hasRoom ? "Room found" : "Room not found");
-    
-    return hasRoom;
+    return report;
 }
 
-bool server::updateUserAvatar(const QString &userId,
+quint64 server::getRoomLastSeq(const QString &roomId) const {
+    RoomLogPtr log = roomLogs.find(roomId);
+    if (log && log->isLoaded()) {
+        return log->getLastSeq();
+    }
+    // Not read since login: the inbox row has it from the file's tail
+    RoomKey key = UserIds::getInstance()->findRoomKeyForRoomId(roomId);
+    auto inboxIt = userInbox.constFind(UserIds::firstOf(key));
+    if (key == 0 || inboxIt == userInbox.constEnd()) {
+        return 0;
+    }
+    return inboxIt.value().value(roomId).lastSeq;
+}
+
+void server::loadRoomMeta(const QString &roomId) {
+    // Watermarks belong to two-person rooms, keyed like the room directory
+    RoomKey key = UserIds::getInstance()->findRoomKeyForRoomId(roomId);
+    if (key == 0) {
+        return;
+    }
+    QHash<UserHandle, quint64> marks;
+    roomLogs.waitForFile(roomId); // A queued watermark write may be pending
+
+    QFile file("../db/rooms_meta/" + roomId + ".txt");
+    bool derived = false;
+    if (file.open(QIODevice::ReadOnly | QIODevice::Text)) {
+        QTextStream in(&file);
+        while (!in.atEnd()) {
+            QString line = in.readLine().trimmed();
+            if (line.startsWith("READ:")) {
+                QStringList parts = line.mid(5).split('|');
+                if (parts.size() == 2) {
+                    marks[userHandle(normalizeUserId(parts[0]))] = parts[1].toULongLong();
+                }
+            }
+        }
+        file.close();
+    } else {
+        // No watermark record yet: derive one from the legacy per-message
+        // isRead flags. A read message means the other participant has seen
+        // everything up to it, and a sender has always seen their own message.
+        // This reads the whole room once; the result is saved below.
+        derived = true;
+        UserHandle first = UserIds::firstOf(key);
+        UserHandle second = UserIds::secondOf(key);
+        const QVector<MessageRecord> records = roomLogs.acquire(roomId)->getRecords();
+        for (const MessageRecord &record : records) {
+            UserHandle sender = record.sender;
+            marks[sender] = qMax(marks.value(sender), record.seq);
+            if (record.flags & MessageRecord::ReadFlag) {
+                UserHandle reader = first == sender ? second : first;
+                marks[reader] = qMax(marks.value(reader), record.seq);
+            }
+        }
+    }
+
+    if (!marks.isEmpty()) {
+        roomReadMarks[key] = marks;
+        if (derived) {
+            saveRoomMeta(roomId); // Migrated: later logins read the small file
+        }
+    }
+}
+
+void server::saveRoomMeta(const QString &roomId) {
+    // Handles are process-local, so the file keeps the user IDs
+    QString contents;
+    UserIds *ids = UserIds::getInstance();
+    RoomKey key = ids->findRoomKeyForRoomId(roomId);
+    const QHash<UserHandle, quint64> marks = roomReadMarks.value(key);
+    for (auto it = marks.constBegin(); it != marks.constEnd(); ++it) {
+        contents += "READ:" + ids->idOf(it.key()) + "|" + QString::number(it.value()) + "\n";
+    }
+
+    // Written on the room's shard, behind the room's message appends
+    QString path = "../db/rooms_meta/" + roomId + ".txt";
+    roomShards.post(key, [path, contents]() {
+        QFile file(path);
+        if (file.open(QIODevice::WriteOnly | QIODevice::Text)) {
+            QTextStream out(&file);
+            out << contents;
+            file.close();
+        } else {
+            qDebug() << "Failed to save read watermarks" << path << ":" << file.errorString();
+        }
+    });
+}
+
+void server::flushRoomMeta() {
+    const QSet<QString> rooms = dirtyRoomMeta;
+    dirtyRoomMeta.clear();
+    for (const QString &roomId : rooms) {
+        saveRoomMeta(roomId);
+    }
+}
+
+quint64 server::getReadWatermark(const QString &roomId,
+                                 const QString &userId) const {
+    auto it = roomReadMarks.constFind(UserIds::getInstance()->findRoomKeyForRoomId(roomId));
+    if (it == roomReadMarks.constEnd()) {
+        return 0;
+    }
+    return it.value().value(findUserHandle(userId), 0);
+}
+
+bool server::markRoomRead(const QString &roomId, const QString &userId,
+                          quint64 seq) {
+    // Load the persisted watermarks before moving one
+    hydrateRoom(roomId);
+
+    RoomKey key = UserIds::getInstance()->findRoomKeyForRoomId(roomId);
+    if (key == 0) {
+        return false; // Not a two-person room
+    }
+
+    // Watermarks only move forward
+    UserHandle handle = userHandle(userId);
+    quint64 &mark = roomReadMarks[key][handle];
+    if (seq <= mark) {
+        return false;
+    }
+
+    mark = seq;
+    dirtyRoomMeta.insert(roomId); // Written by the next flushRoomMeta
+
+    // Keep the reader's inbox row in step with the new watermark
+    auto inboxIt = userInbox.find(handle);
+    if (inboxIt != userInbox.end() && inboxIt.value().contains(roomId)) {
+        inboxIt.value()[roomId].unreadCount = getUnreadCount(roomId, userId);
+    }
+    qDebug() << "User" << userId << "has read room" << roomId << "up to seq"
+             << seq;
+    return true;
+}
+
+int server::getUnreadCount(const QString &roomId, const QString &userId) const {
+    // Senders advance their own watermark, so everything past it is unread
+    quint64 lastSeq = getRoomLastSeq(roomId);
+    quint64 mark = getReadWatermark(roomId, userId);
+    return lastSeq > mark ? int(lastSeq - mark) : 0;
+}
+
+void server::refreshInboxForRoom(const QString &roomId) {
+    RoomKey key = UserIds::getInstance()->findRoomKeyForRoomId(roomId);
+    if (key == 0) {
+        return;
+    }
+    const UserHandle participants[2] = {UserIds::firstOf(key), UserIds::secondOf(key)};
+
+    // Only the newest message matters: O(1) from a loaded log, otherwise
+    // the file's last line, so a login never reads whole conversations
+    Message last;
+    RoomLogPtr log = roomLogs.find(roomId);
+    if (log && log->isLoaded()) {
+        if (log->isEmpty()) {
+            return;
+        }
+        last = log->at(log->size() - 1);
+    } else if (!RoomLog::readTail(roomId, last)) {
+        return;
+    }
+    QString preview = last.getContent().left(80);
+
+    UserIds *ids = UserIds::getInstance();
+    for (int i = 0; i < 2; ++i) {
+        const QString userId = ids->idOf(participants[i]);
+        QMap<QString, InboxEntry> &inbox = userInbox[participants[i]];
+        QMap<ActivityKey, QString> &recent = userRecent[participants[i]];
+
+        // Re-key the room in the activity index: drop the old position first
+        auto existing = inbox.find(roomId);
+        if (existing != inbox.end()) {
+            recent.remove(ActivityKey{
+                existing.value().lastActivity.toMSecsSinceEpoch(), roomId});
+        }
+
+        InboxEntry &entry = inbox[roomId];
+        entry.roomId = roomId;
+        entry.peerId = ids->idOf(participants[1 - i]);
+        entry.lastMessage = preview;
+        entry.lastSender = last.getSender();
+        entry.lastActivity = last.getTimestamp();
+        entry.lastSeq = last.getSeq();
+        quint64 mark = getReadWatermark(roomId, userId);
+        entry.unreadCount = entry.lastSeq > mark ? int(entry.lastSeq - mark) : 0;
+
+        recent.insert(ActivityKey{entry.lastActivity.toMSecsSinceEpoch(), roomId},
+                      roomId);
+    }
+}
+
+QVector<InboxEntry> server::recentConversations(const QString &userId,
+                                                int offset, int limit) const {
+    QVector<InboxEntry> result;
+    UserHandle handle = findUserHandle(userId);
+    auto recentIt = userRecent.constFind(handle);
+    auto inboxIt = userInbox.constFind(handle);
+    if (recentIt == userRecent.constEnd() || inboxIt == userInbox.constEnd()) {
+        return result;
+    }
+
+    const QMap<ActivityKey, QString> &recent = recentIt.value();
+    const QMap<QString, InboxEntry> &inbox = inboxIt.value();
+
+    // The index is already in activity order, so just walk it
+    auto it = recent.constBegin();
+    for (int skipped = 0; skipped < offset && it != recent.constEnd(); ++skipped) {
+        ++it;
+    }
+    for (; it != recent.constEnd() && (limit < 0 || result.size() < limit); ++it) {
+        result.append(inbox.value(it.value()));
+    }
+    return result;
+}
+
+QVector<InboxEntry> server::getInbox(const QString &userId) const {
+    QVector<InboxEntry> inbox;
+    auto it = userInbox.constFind(findUserHandle(userId));
+    if (it == userInbox.constEnd()) {
+        return inbox;
+    }
+
+    inbox.reserve(it.value().size());
+    for (const InboxEntry &entry : it.value()) {
+        inbox.append(entry);
+    }
+    return inbox;
+}
+
+bool server::addContactForUser(const QString &userId,
+                               const QString &contactId) {
+    if (!userMap.contains(userId)) {
+        qDebug() << "User" << userId << "not found for adding contact";
+        return false;
+    }
+
+    // The user file is rewritten below, so its current contents must be loaded
+    hydrateUser(userId);
+    UserHandle user = userHandle(userId);
+
+    // Create contacts vector if it doesn't exist
+    if (!userContacts.contains(user)) {
+        userContacts[user] = QVector<QString>();
+    }
+
+    // Add the contact if it's not already there
+    if (social.add(SocialGraph::Contact, user, userHandle(contactId))) {
+        userContacts[user].append(contactId);
+
+        // Save to disk immediately
+        saveUserContacts(userId);
+        qDebug() << "Added contact" << contactId << "for user" << userId;
+        return true;
+    }
+
+    return false; // Contact already existed
+}
+
+bool server::hasContactForUser(const QString &userId,
+                               const QString &contactId) {
+    hydrateUser(userId);
+    return social.has(SocialGraph::Contact, findUserHandle(userId), findUserHandle(contactId));
+}
+
+bool server::addRoomToUser(const QString &userId, Room *room) {
+    if (!userMap.contains(userId) || !room) {
+        qDebug() << "User" << userId
+                 << "not found or invalid room for adding room";
+        return false;
+    }
+
+    // The user file is rewritten below, so its current contents must be loaded
+    hydrateUser(userId);
+    UserHandle user = userHandle(userId);
+
+    // Create rooms map if it doesn't exist
+    if (!userRooms.contains(user)) {
+        userRooms[user] = QMap<QString, Room *>();
+    }
+
+    // Add the room if it's not already there
+    QString roomId = room->getRoomId();
+    if (!userRooms[user].contains(roomId)) {
+        userRooms[user][roomId] = room;
+
+        // The room's messages are already in the shared log store
+        indexRoomFile(roomId);
+
+        // Save to disk immediately
+        saveUserContacts(userId);
+        qDebug() << "Added room" << roomId << "for user" << userId;
+        return true;
+    }
+
+    return false; // Room already existed
+}
+
+bool server::hasRoomForUser(const QString &userId, const QString &roomId) {
+    qDebug() << "Checking if user" << userId << "has room" << roomId;
+    hydrateUser(userId);
+    
+    // First make sure the user exists in our data structure
+    if (!userRooms.contains(findUserHandle(userId))) {
+        qDebug() << "User" << userId << "not found in userRooms map";
+        return false;
+    }
+    
+    // Check if the room exists for this user
+    bool hasRoom = userRooms.value(findUserHandle(userId)).contains(roomId);
+    qDebug() << "Result:" << (hasRoom ? "Room found" : "Room not found");
+    
+    return hasRoom;
+}
+
+bool server::updateUserAvatar(const QString &userId,
                               const QString &avatarPath) {
     if (!userMap.contains(userId)) {
         qDebug() << "User" << userId << "not found for updating avatar";
@@ -1269,6 +2006,7 @@ bool server::updateUserAvatar(const QString &userId,
     }
 
     userMap[userId].avatarPath = avatarPath;
+    syncUserIndexes(userId);
 
     // Save settings immediately to ensure persistence
     QString settingsPath = "../db/settings/" + userId + "_settings.txt";
@@ -1291,12 +2029,13 @@ bool server::updateUserAvatar(const QString &userId,
 }
 
 QString server::getUserAvatar(const QString &userId) const {
-    if (!userMap.contains(userId)) {
+    const UserProfile *profile = profiles.find(userId);
+    if (!profile) {
         qDebug() << "User" << userId << "not found for getting avatar";
         return QString();
     }
 
-    return userMap[userId].avatarPath;
+    return profile->avatarPath;
 }
 
 bool server::changePassword(const QString &userId,
@@ -1370,6 +2109,7 @@ void server::loadStories() {
 
             StoryData story;
             story.id = storyId;
+            QVector<QPair<QString, QDateTime>> legacyViews;
 
             while (!in.atEnd()) {
                 QString line = in.readLine().trimmed();
@@ -1388,7 +2128,8 @@ void server::loadStories() {
                         story.timestamp = QDateTime::currentDateTime();
                     }
                 } else if (line.startsWith("VIEWER:")) {
-                    // Parse viewer ID and view time
+                    // Older .meta files list viewers inline; read them
+                    // once, the next save moves them to the .viewers log
                     QString viewerInfo = line.mid(7).trimmed();
                     QStringList parts = viewerInfo.split('|');
                     QString viewerId = parts.first().trimmed();
@@ -1400,14 +2141,9 @@ void server::loadStories() {
                     }
 
                     if (!viewerId.isEmpty()) {
-                        story.viewers.insert(viewerId);
-                        // Also store the view time if valid
-                        if (viewTime.isValid()) {
-                            story.viewTimes[viewerId] = viewTime;
-                        } else {
-                            story.viewTimes[viewerId] =
-                                QDateTime::currentDateTime();
-                        }
+                        legacyViews.append(qMakePair(
+                            viewerId, viewTime.isValid() ? viewTime
+                                                         : QDateTime::currentDateTime()));
                     }
                 }
             }
@@ -1425,20 +2161,42 @@ void server::loadStories() {
                     3600); // Changed from 30 to 3600 seconds (1 hour)
 
                 if (now < expirationTime) {
+                    // Replay the view log in order, after any inline viewers
+                    QVector<StoryViewers::View> views;
+                    for (const auto &view : legacyViews) {
+                        views.append(StoryViewers::View(
+                            userHandle(view.first),
+                            StoryViewers::clampOffset(story.timestamp.secsTo(view.second))));
+                    }
+                    QFile viewersFile(storyViewersPath(storyId));
+                    if (viewersFile.open(QIODevice::ReadOnly)) {
+                        QVector<QPair<QString, quint16>> records;
+                        if (!StoryViewers::decode(viewersFile.readAll(), records)) {
+                            qDebug() << "Ignoring malformed viewer log for story" << storyId;
+                        }
+                        for (const auto &record : records) {
+                            views.append(StoryViewers::View(userHandle(record.first),
+                                                            record.second));
+                        }
+                        viewersFile.close();
+                    }
+                    story.viewers.assign(views);
                     stories.append(story);
                     qDebug()
                         << "Loaded story:" << story.id << "by" << story.userId;
                 } else {
-                    // Delete expired story files
-                    QFile::remove(storiesDir.filePath(storyFile));
-                    QFile::remove(story.imagePath);
-                    qDebug() << "Removed expired story:" << story.id;
+                    // Delete expired story files off the startup path
+                    removeFilesLater({storiesDir.filePath(storyFile), story.imagePath,
+                                      storyViewersPath(storyId)});
+                    qDebug() << "Removing expired story:" << story.id;
                 }
             }
         }
     }
 
     qDebug() << "Loaded" << stories.size() << "stories";
+    storiesChanged = true;
+    publishReadState();
 }
 
 void server::saveStories() {
@@ -1465,20 +2223,8 @@ void server::saveStories() {
             out << "TIMESTAMP:" << story.timestamp.toString(Qt::ISODate)
                 << "\n";
 
-            // Save viewers with view time
-            QSetIterator<QString> i(story.viewers);
-            while (i.hasNext()) {
-                QString viewerId = i.next();
-                QDateTime viewTime = story.viewTimes.value(viewerId);
-                if (viewTime.isValid()) {
-                    out << "VIEWER:" << viewerId << "|"
-                        << viewTime.toString(Qt::ISODate) << "\n";
-                } else {
-                    out << "VIEWER:" << viewerId << "\n";
-                }
-            }
-
             file.close();
+            saveStoryViewers(story);
             qDebug() << "Saved story:" << story.id;
         } else {
             qDebug() << "Failed to save story:" << story.id;
@@ -1488,6 +2234,55 @@ void server::saveStories() {
     qDebug() << "Saved" << stories.size() << "stories";
 }
 
+void server::saveStoryViewers(const StoryData &story) {
+    // Compact the log down to one record per viewer
+    UserIds *ids = UserIds::getInstance();
+    QByteArray contents = StoryViewers::header();
+    const QVector<StoryViewers::View> views = story.viewers.views();
+    for (const StoryViewers::View &view : views) {
+        contents += StoryViewers::encode(ids->idOf(view.first), view.second);
+    }
+
+    QString path = storyViewersPath(story.id);
+    jobs.submit([path, contents]() {
+        QFile file(path);
+        if (file.open(QIODevice::WriteOnly)) {
+            file.write(contents);
+            file.close();
+        } else {
+            qDebug() << "Failed to write" << path << ":" << file.errorString();
+        }
+    }, TaskPool::Background, storyAffinity(story.id));
+}
+
+void server::appendStoryView(const QString &storyId, const QString &viewerId,
+                             quint16 offset) {
+    QString path = storyViewersPath(storyId);
+    QByteArray record = StoryViewers::encode(viewerId, offset);
+    jobs.submit([path, record]() {
+        QFile file(path);
+        if (file.open(QIODevice::WriteOnly | QIODevice::Append)) {
+            if (file.size() == 0) {
+                file.write(StoryViewers::header());
+            }
+            file.write(record);
+            file.close();
+        } else {
+            qDebug() << "Failed to append to" << path << ":" << file.errorString();
+        }
+    }, TaskPool::Background, storyAffinity(storyId));
+}
+
+void server::removeStoryViewersLater(const QString &storyId) {
+    // Pinned like the appends, so none can recreate the file afterwards
+    QString path = storyViewersPath(storyId);
+    jobs.submit([path]() {
+        if (QFile::exists(path) && !QFile::remove(path)) {
+            qDebug() << "Failed to remove" << path;
+        }
+    }, TaskPool::Background, storyAffinity(storyId));
+}
+
 QString server::addStory(const QString &userId, const QString &imagePath,
                          const QString &caption) {
     if (!userMap.contains(userId)) {
@@ -1509,6 +2304,8 @@ QString server::addStory(const QString &userId, const QString &imagePath,
 
     // Add to the stories list
     stories.append(story);
+    storiesChanged = true;
+    publishReadState();
 
     // Save to disk
     saveStories();
@@ -1525,6 +2322,8 @@ bool server::deleteStory(const QString &storyId) {
 
             // Remove from the list
             stories.remove(i);
+            storiesChanged = true;
+            publishReadState();
 
             // Delete the meta file
             QString metaPath = "../db/stories/" + storyId + ".meta";
@@ -1532,6 +2331,7 @@ bool server::deleteStory(const QString &storyId) {
 
             // Delete the image file
             QFile::remove(imagePath);
+            removeStoryViewersLater(storyId);
 
             qDebug() << "Deleted story:" << storyId;
 
@@ -1549,17 +2349,20 @@ bool server::markStoryAsViewed(const QString &storyId,
                                const QString &viewerId) {
     for (int i = 0; i < stories.size(); ++i) {
         if (stories[i].id == storyId) {
-            // Add viewer to the set
-            stories[i].viewers.insert(viewerId);
-
-            // Record the view time
-            stories[i].viewTimes[viewerId] = QDateTime::currentDateTime();
-
-            // Save changes
-            saveStories();
+            StoryData &story = stories[i];
+            qint64 secsSincePost = story.timestamp.secsTo(QDateTime::currentDateTime());
+            UserHandle viewer = userHandle(viewerId);
+            int previousOffset = story.viewers.offsetOf(viewer);
+            bool firstView = story.viewers.record(viewer, secsSincePost);
+
+            // One record appended to the story's view log, not a rewrite of
+            // every story; a repeat view within the same second adds nothing
+            if (firstView || story.viewers.offsetOf(viewer) != previousOffset) {
+                appendStoryView(storyId, viewerId, StoryViewers::clampOffset(secsSincePost));
+            }
 
             qDebug() << "Marked story" << storyId << "as viewed by" << viewerId
-                     << "at" << stories[i].viewTimes[viewerId].toString();
+                     << "(" << story.viewers.size() << "viewers )";
             return true;
         }
     }
@@ -1594,7 +2397,8 @@ bool server::hasViewedStory(const QString &storyId,
                             const QString &userId) const {
     for (const StoryData &story : stories) {
         if (story.id == storyId) {
-            return story.viewers.contains(userId);
+            UserHandle viewer = findUserHandle(userId);
+            return viewer != 0 && story.viewers.contains(viewer);
         }
     }
 
@@ -1604,7 +2408,7 @@ bool server::hasViewedStory(const QString &storyId,
 void server::cleanupOldStories() {
     QDateTime now = QDateTime::currentDateTime();
     QVector<StoryData> validStories;
-    QSet<QString> storiesToRemove; // Track stories that need to be deleted
+    QStringList expiredFiles;
 
     // First identify which stories to keep and which to remove
     for (const StoryData &story : stories) {
@@ -1617,60 +2421,35 @@ void server::cleanupOldStories() {
             // Story is still valid
             validStories.append(story);
         } else {
-            // Mark for removal but don't delete files yet
-            storiesToRemove.insert(story.id);
+            expiredFiles << "../db/stories/" + story.id + ".meta";
+            if (!story.imagePath.isEmpty()) {
+                expiredFiles << story.imagePath;
+            }
+            removeStoryViewersLater(story.id);
             qDebug() << "Marking story for cleanup:" << story.id;
         }
     }
+    if (expiredFiles.isEmpty()) {
+        return;
+    }
 
-    // Update the stories list first (important for thread safety)
+    // Update the stories list first, so nobody is shown a story whose
+    // files are about to go
     stories = validStories;
+    storiesChanged = true;
+    publishReadState();
+    removeFilesLater(expiredFiles);
+}
 
-    // Now that the in-memory list is updated, we can safely delete the files
-    for (const QString &storyId : storiesToRemove) {
-        // Find the image path in case it's needed for deletion
-        QString imagePath;
-        for (const StoryData &story : validStories) {
-            if (story.id == storyId) {
-                imagePath = story.imagePath;
-                break;
-            }
-        }
-
-        // If we didn't find the image path in valid stories, it might be
-        // available in the meta file, so try to read it
-        if (imagePath.isEmpty()) {
-            QString metaPath = "../db/stories/" + storyId + ".meta";
-            QFile metaFile(metaPath);
-            if (metaFile.open(QIODevice::ReadOnly | QIODevice::Text)) {
-                QTextStream in(&metaFile);
-                while (!in.atEnd()) {
-                    QString line = in.readLine();
-                    if (line.startsWith("IMAGE:")) {
-                        imagePath = line.mid(6).trimmed();
-                        break;
-                    }
-                }
-                metaFile.close();
+void server::removeFilesLater(const QStringList &paths) {
+    jobs.submit([paths]() {
+        for (const QString &path : paths) {
+            if (!path.isEmpty() && QFile::exists(path) && !QFile::remove(path)) {
+                qDebug() << "Failed to remove" << path;
             }
         }
-
-        // Now try to delete files safely
-        QString metaPath = "../db/stories/" + storyId + ".meta";
-        bool metaDeleted = QFile::remove(metaPath);
-
-        if (!imagePath.isEmpty()) {
-            bool imageDeleted = QFile::remove(imagePath);
-            qDebug() << "Cleaned up expired story:" << storyId
-                     << "- Meta file deleted:" << metaDeleted
-                     << "- Image file deleted:" << imageDeleted
-                     << "- Image path:" << imagePath;
-        } else {
-            qDebug() << "Cleaned up expired story:" << storyId
-                     << "- Meta file deleted:" << metaDeleted
-                     << "- Image file not found";
-        }
-    }
+        qDebug() << "Removed" << paths.size() << "expired files";
+    }, TaskPool::Background);
 }
 
 int server::getStoryViewerCount(const QString &storyId) const {
@@ -1685,7 +2464,15 @@ int server::getStoryViewerCount(const QString &storyId) const {
 QSet<QString> server::getStoryViewers(const QString &storyId) const {
     for (const StoryData &story : stories) {
         if (story.id == storyId) {
-            return story.viewers;
+            // Only the viewer list dialog asks for IDs
+            UserIds *ids = UserIds::getInstance();
+            QSet<QString> viewers;
+            const QVector<StoryViewers::View> views = story.viewers.views();
+            viewers.reserve(views.size());
+            for (const StoryViewers::View &view : views) {
+                viewers.insert(ids->idOf(view.first));
+            }
+            return viewers;
         }
     }
     return QSet<QString>();
@@ -1695,7 +2482,8 @@ QDateTime server::getStoryViewTime(const QString &storyId,
                                    const QString &viewerId) const {
     for (const StoryData &story : stories) {
         if (story.id == storyId) {
-            return story.viewTimes.value(viewerId);
+            int offset = story.viewers.offsetOf(findUserHandle(viewerId));
+            return offset < 0 ? QDateTime() : story.timestamp.addSecs(offset);
         }
     }
     return QDateTime(); // Return invalid datetime if not found
@@ -1709,43 +2497,28 @@ bool server::blockUserForClient(const QString &clientId,
         return false;
     }
 
-    // Check if we need to create a new entry for blocked users
-    if (!blockedUsers.contains(clientId)) {
-        blockedUsers[clientId] = QVector<QString>();
-    }
-
-    // Check if already blocked
-    if (blockedUsers[clientId].contains(userToBlock)) {
+    if (!social.add(SocialGraph::Block, userHandle(clientId), userHandle(userToBlock))) {
         qDebug() << "User" << userToBlock << "is already blocked by"
                  << clientId;
         return true; // Already blocked, so consider it a success
     }
-
-    // Add to blocked list
-    blockedUsers[clientId].append(userToBlock);
+    republishBlocks(userHandle(clientId));
+    publishReadState();
+    appendBlockDelta(clientId, '+', userToBlock);
     qDebug() << "User" << userToBlock << "blocked by" << clientId;
 
-    // Save to file
-    QString blockedPath = "../db/users/" + clientId + "_blocked.txt";
-    QFile file(blockedPath);
-
-    if (file.open(QIODevice::WriteOnly | QIODevice::Text)) {
-        QTextStream out(&file);
-        for (const QString &user : blockedUsers[clientId]) {
-            out << user << "\n";
-        }
-        file.close();
-        qDebug() << "Saved blocked users list for" << clientId;
-    } else {
-        qDebug() << "Failed to save blocked users for" << clientId;
-        // Continue anyway as we've updated the in-memory structure
-    }
-
     // Remove from contacts if present
+    hydrateUser(clientId);
+    if (social.remove(SocialGraph::Contact, userHandle(clientId), userHandle(userToBlock))) {
+        userContacts[userHandle(clientId)].removeAll(userToBlock);
+        dirtyUserFiles.insert(clientId);
+    }
     Client *client = getClient(clientId);
     if (client && client->hasContact(userToBlock)) {
         client->removeContact(userToBlock);
         qDebug() << "Removed" << userToBlock << "from contacts of" << clientId;
+    }
+    if (dirtyUserFiles.contains(clientId)) {
         saveUserContacts(clientId);
     }
 
@@ -1754,22 +2527,18 @@ bool server::blockUserForClient(const QString &clientId,
 
 bool server::isUserBlocked(const QString &clientId,
                            const QString &userToCheck) const {
-    if (!blockedUsers.contains(clientId)) {
-        return false;
-    }
-
-    return blockedUsers[clientId].contains(userToCheck);
+    return readState()->isBlocked(findUserHandle(clientId), findUserHandle(userToCheck));
 }
 
 QVector<QString> server::getBlockedUsers(const QString &clientId) const {
-    if (!blockedUsers.contains(clientId)) {
-        return QVector<QString>();
+    QVector<QString> blocked;
+    UserIds *ids = UserIds::getInstance();
+    for (UserHandle other : social.targets(SocialGraph::Block, findUserHandle(clientId))) {
+        blocked.append(ids->idOf(other));
     }
-
-    return blockedUsers[clientId];
+    return blocked;
 }
 
-// Add the unblockUserForClient method implementation
 bool server::unblockUserForClient(const QString &clientId,
                                   const QString &userToUnblock) {
     // Make sure client exists
@@ -1778,39 +2547,15 @@ bool server::unblockUserForClient(const QString &clientId,
         return false;
     }
 
-    // Check if we have a blocked users list for this client
-    if (!blockedUsers.contains(clientId)) {
-        qDebug() << "User" << userToUnblock << "is not blocked by" << clientId
-                 << "(no blocked users list)";
-        return true; // No blocked users list means nothing to unblock
-    }
-
-    // Check if user is blocked
-    if (!blockedUsers[clientId].contains(userToUnblock)) {
+    if (!social.remove(SocialGraph::Block, userHandle(clientId), userHandle(userToUnblock))) {
         qDebug() << "User" << userToUnblock << "is not blocked by" << clientId;
         return true; // Not blocked, so consider it a success
     }
-
-    // Remove from blocked list
-    blockedUsers[clientId].removeAll(userToUnblock);
+    republishBlocks(userHandle(clientId));
+    publishReadState();
+    appendBlockDelta(clientId, '-', userToUnblock);
     qDebug() << "User" << userToUnblock << "unblocked by" << clientId;
 
-    // Save to file
-    QString blockedPath = "../db/users/" + clientId + "_blocked.txt";
-    QFile file(blockedPath);
-
-    if (file.open(QIODevice::WriteOnly | QIODevice::Text)) {
-        QTextStream out(&file);
-        for (const QString &user : blockedUsers[clientId]) {
-            out << user << "\n";
-        }
-        file.close();
-        qDebug() << "Saved updated blocked users list for" << clientId;
-    } else {
-        qDebug() << "Failed to save blocked users for" << clientId;
-        // Continue anyway as we've updated the in-memory structure
-    }
-
     return true;
 }
 
@@ -1935,8 +2680,9 @@ void server::repairInconsistentRoomFiles() {
     }
     
     // For each user with contacts, verify room files exist
-    for (const QString &userId : userContacts.keys()) {
-        const QVector<QString> &contacts = userContacts[userId];
+    for (auto userIt = userContacts.constBegin(); userIt != userContacts.constEnd(); ++userIt) {
+        QString userId = UserIds::getInstance()->idOf(userIt.key());
+        const QVector<QString> &contacts = userIt.value();
         
         for (const QString &contactId : contacts) {
             QString expectedRoomId = Room::generateRoomId(userId, contactId);
@@ -2116,3 +2862,471 @@ void server::updateRoomReferencesInUserFiles(const QString &oldRoomId, const QSt
         }
     }
 }
+
+void server::indexRoomFile(const QString &roomId) {
+    // Registration interns both participants
+    RoomKey key = UserIds::getInstance()->roomKeyForRoomId(roomId);
+    if (key == 0) {
+        // Legacy hash-named rooms have no participants to index
+        qDebug() << "Skipping unindexable room file:" << roomId;
+        return;
+    }
+    registerRoom(key, roomId);
+}
+
+QString server::findRoomId(const QString &userA, const QString &userB) const {
+    UserIds *ids = UserIds::getInstance();
+    UserHandle a = ids->find(normalizeUserId(userA));
+    UserHandle b = ids->find(normalizeUserId(userB));
+    if (a == 0 || b == 0) {
+        return QString();
+    }
+    return roomDirectory.value(UserIds::roomKey(a, b));
+}
+
+void server::registerRoom(RoomKey key, const QString &roomId) {
+    if (key == 0) {
+        return;
+    }
+    if (!roomDirectory.contains(key)) {
+        roomsByUser[UserIds::firstOf(key)].append(key);
+        roomsByUser[UserIds::secondOf(key)].append(key);
+    }
+    roomDirectory.insert(key, roomId);
+}
+
+bool server::hasRoom(const QString &roomId) const {
+    RoomKey key = UserIds::getInstance()->findRoomKeyForRoomId(roomId);
+    return key != 0 && roomDirectory.contains(key);
+}
+
+void server::hydrateUser(const QString &userId) {
+    if (hydratedUsers.contains(userId) || !userMap.contains(userId)) {
+        return;
+    }
+    hydratedUsers.insert(userId);
+
+    // Contacts and room list from the user's file
+    loadUserContacts(userId);
+
+    // Every room this user takes part in, so the inbox is complete
+    auto it = roomsByUser.constFind(findUserHandle(userId));
+    if (it != roomsByUser.constEnd()) {
+        for (RoomKey key : it.value()) {
+            hydrateRoom(roomDirectory.value(key));
+        }
+    }
+    qDebug() << "Hydrated user" << userId;
+}
+
+void server::hydrateRoom(const QString &roomId) {
+    if (roomId.isEmpty() || hydratedRooms.contains(roomId)) {
+        return;
+    }
+    hydratedRooms.insert(roomId);
+
+    // Watermarks and the inbox row only; the messages are read when the
+    // room is first opened or paged (RoomLogStore::acquire)
+    loadRoomMeta(roomId);
+    refreshInboxForRoom(roomId);
+}
+
+MemoryUsage server::memoryUsage() const {
+    MemoryUsage usage;
+    usage.roomLogBytes = roomLogs.residentBytes(&usage.loadedRoomLogs);
+
+    for (const Client *client : clients) {
+        usage.clientBytes += client->residentBytes();
+    }
+    usage.residentClients = clients.size();
+
+    for (const QMap<QString, InboxEntry> &inbox : userInbox) {
+        for (const InboxEntry &entry : inbox) {
+            usage.inboxBytes += sizeof(InboxEntry) +
+                                (entry.roomId.capacity() + entry.peerId.capacity() +
+                                 entry.lastMessage.capacity() + entry.lastSender.capacity()) *
+                                    qint64(sizeof(QChar));
+        }
+    }
+    for (const QMap<ActivityKey, QString> &recent : userRecent) {
+        usage.inboxBytes += recent.size() * qint64(sizeof(ActivityKey) + sizeof(QString));
+    }
+
+    for (const QString &roomId : roomDirectory) {
+        usage.directoryBytes += sizeof(RoomKey) + sizeof(QString) + roomId.capacity() * qint64(sizeof(QChar));
+    }
+    for (const QVector<RoomKey> &keys : roomsByUser) {
+        usage.directoryBytes += sizeof(UserHandle) + keys.capacity() * qint64(sizeof(RoomKey));
+    }
+
+    usage.directoryBytes += directory.residentBytes() + profiles.residentBytes() +
+                            social.residentBytes();
+
+    for (const MessageIndex &index : messageIndexes) {
+        usage.searchIndexBytes += index.residentBytes();
+    }
+    return usage;
+}
+
+void server::evictClient(const QString &userId) {
+    Client *client = clients.value(userId, nullptr);
+    if (!client || client == currentClient) {
+        return;
+    }
+
+    // Persist first, which also hands the client's rooms to userRooms; the
+    // client only views them, so it can go before or after the rooms and the
+    // user is re-hydrated on next login
+    saveClientData(client);
+    if (dirtyUserFiles.contains(userId)) {
+        saveUserContacts(userId);
+    }
+    dropUserRooms(findUserHandle(userId));
+    userContacts.remove(findUserHandle(userId));
+    social.clear(SocialGraph::Contact, findUserHandle(userId)); // Reloaded with the user
+    hydratedUsers.remove(userId);
+    messageIndexes.remove(findUserHandle(userId));
+
+    clients.remove(userId);
+    clientLastActive.remove(userId);
+    delete client;
+    qDebug() << "Evicted idle client" << userId;
+}
+
+void server::dropUserRooms(UserHandle user) {
+    qDeleteAll(userRooms.take(user));
+}
+
+void server::enforceMemoryBudget() {
+    operationsSinceTrim = 0;
+
+    MemoryUsage usage = memoryUsage();
+    if (usage.total() <= memoryBudget) {
+        return;
+    }
+
+    // Cold room histories are the cheapest to bring back, so spill those first
+    qint64 otherBytes = usage.total() - usage.roomLogBytes;
+    int spilled = roomLogs.evictToBudget(qMax<qint64>(0, memoryBudget - otherBytes));
+    if (spilled > 0) {
+        usage = memoryUsage();
+    }
+
+    // Then drop the least recently active clients until we fit
+    while (usage.total() > memoryBudget && clients.size() > 1) {
+        QString oldest;
+        qint64 oldestMs = 0;
+        for (auto it = clients.constBegin(); it != clients.constEnd(); ++it) {
+            if (it.value() == currentClient) {
+                continue;
+            }
+            qint64 lastActive = clientLastActive.value(it.key(), 0);
+            if (oldest.isEmpty() || lastActive < oldestMs) {
+                oldest = it.key();
+                oldestMs = lastActive;
+            }
+        }
+        if (oldest.isEmpty()) {
+            break;
+        }
+        evictClient(oldest);
+        usage = memoryUsage();
+    }
+
+    qDebug() << "Memory budget" << memoryBudget << "bytes; resident" << usage.total()
+             << "bytes after spilling" << spilled << "room logs";
+}
+
+QVector<QStringList> server::tokenizeMessages(const QVector<QString> &texts) {
+    QVector<QStringList> tokens(texts.size());
+    if (texts.size() < PARALLEL_TOKENIZE_MIN) {
+        for (int i = 0; i < texts.size(); ++i) {
+            tokens[i] = MessageIndex::tokenize(texts[i]);
+        }
+        return tokens;
+    }
+
+    // Tokenizing is most of a build and needs nothing from the server, so
+    // the pool's workers and this thread each take a slice. The caller is
+    // waiting, so the slices go in as interactive tasks.
+    const QString *in = texts.constData();
+    QStringList *out = tokens.data();
+    const int slices = jobs.workerCount() + 1;
+    const int sliceSize = (texts.size() + slices - 1) / slices;
+    QSemaphore done;
+    int submitted = 0;
+    for (int begin = sliceSize; begin < texts.size(); begin += sliceSize) {
+        int end = qMin(begin + sliceSize, int(texts.size()));
+        jobs.submit([in, out, begin, end, &done]() {
+            for (int i = begin; i < end; ++i) {
+                out[i] = MessageIndex::tokenize(in[i]);
+            }
+            done.release();
+        }, TaskPool::Interactive);
+        ++submitted;
+    }
+    for (int i = 0; i < qMin(sliceSize, int(texts.size())); ++i) {
+        out[i] = MessageIndex::tokenize(in[i]);
+    }
+    done.acquire(submitted);
+    return tokens;
+}
+
+MessageIndex &server::messageIndexFor(const QString &userId) {
+    UserHandle user = userHandle(userId);
+    auto existing = messageIndexes.find(user);
+    if (existing != messageIndexes.end()) {
+        return existing.value();
+    }
+
+    // Gather every message in the user's rooms and index them oldest first,
+    // so document numbers (and the gaps stored in posting lists) grow with time
+    struct Pending {
+        qint64 timestampMs;
+        quint32 room;
+        quint64 seq;
+        int log;
+        int record;
+    };
+    MessageIndex &index = messageIndexes[user];
+    QVector<RoomLogPtr> logs;
+    QVector<Pending> pending;
+    for (RoomKey key : roomsByUser.value(user)) {
+        QString roomId = roomDirectory.value(key);
+        if (roomId.isEmpty()) {
+            continue;
+        }
+        hydrateRoom(roomId);
+        RoomLogPtr log = roomLogs.acquire(roomId);
+        quint32 slot = index.roomSlot(roomId);
+        const QVector<MessageRecord> &records = log->getRecords();
+        for (int i = 0; i < records.size(); ++i) {
+            pending.append(Pending{records[i].timestampMs, slot, records[i].seq, logs.size(), i});
+        }
+        logs.append(log);
+    }
+    std::sort(pending.begin(), pending.end(), [](const Pending &a, const Pending &b) {
+        if (a.timestampMs != b.timestampMs) {
+            return a.timestampMs < b.timestampMs;
+        }
+        return a.room != b.room ? a.room < b.room : a.seq < b.seq;
+    });
+    QVector<QString> texts;
+    texts.reserve(pending.size());
+    for (const Pending &entry : pending) {
+        const RoomLogPtr &log = logs[entry.log];
+        texts.append(log->textOf(log->getRecords().at(entry.record)));
+    }
+    QVector<QStringList> tokens = tokenizeMessages(texts);
+    for (int i = 0; i < pending.size(); ++i) {
+        index.addTokens(pending[i].room, pending[i].seq, tokens[i]);
+    }
+
+    qDebug() << "Built message index for" << userId << ":" << index.docCount()
+             << "messages," << index.termCount() << "terms";
+    return index;
+}
+
+void server::indexMessage(const QString &roomId, quint64 seq, const QString &text) {
+    if (messageIndexes.isEmpty()) {
+        return;
+    }
+    RoomKey key = UserIds::getInstance()->findRoomKeyForRoomId(roomId);
+    for (UserHandle user : {UserIds::firstOf(key), UserIds::secondOf(key)}) {
+        auto it = messageIndexes.find(user);
+        if (it != messageIndexes.end()) {
+            it.value().add(it.value().roomSlot(roomId), seq, text);
+        }
+    }
+}
+
+void server::dropMessageIndexes(const QString &roomId) {
+    RoomKey key = UserIds::getInstance()->findRoomKeyForRoomId(roomId);
+    messageIndexes.remove(UserIds::firstOf(key));
+    messageIndexes.remove(UserIds::secondOf(key));
+}
+
+QVector<MessageSearchHit> server::searchMessages(const QString &userId, const QString &query,
+                                                 int limit, int offset) {
+    QVector<MessageSearchHit> hits;
+    QStringList terms = MessageIndex::tokenize(query);
+    terms.removeDuplicates();
+    if (terms.isEmpty() || limit <= 0 || offset < 0 || !userMap.contains(userId)) {
+        return hits;
+    }
+
+    const MessageIndex &index = messageIndexFor(userId);
+    const QVector<MessageIndex::Match> matches = index.search(terms, offset + limit);
+    UserHandle self = findUserHandle(userId);
+    UserIds *ids = UserIds::getInstance();
+
+    // Only the requested page is materialized
+    for (int i = offset; i < matches.size(); ++i) {
+        const MessageIndex::Doc &doc = index.doc(matches[i].doc);
+        QString roomId = index.roomAt(doc.room);
+        RoomLogPtr log = roomLogs.acquire(roomId);
+        int position = log->indexOfSeq(doc.seq);
+        if (position < 0) {
+            continue;
+        }
+
+        RoomKey key = ids->findRoomKeyForRoomId(roomId);
+        UserHandle peer = UserIds::firstOf(key) == self ? UserIds::secondOf(key)
+                                                        : UserIds::firstOf(key);
+        MessageSearchHit hit;
+        hit.roomId = roomId;
+        hit.peerId = ids->idOf(peer);
+        hit.message = log->at(position);
+        hit.score = matches[i].score;
+        hits.append(hit);
+    }
+
+    enforceMemoryBudget();
+    return hits;
+}
+
+void server::syncUserIndexes(const QString &userId) {
+    auto it = userMap.constFind(userId);
+    bool changed;
+    if (it == userMap.constEnd()) {
+        changed = profiles.remove(userId);
+    } else {
+        UserProfile profile;
+        profile.handle = userHandle(userId);
+        profile.nickname = it.value().nickname;
+        profile.bio = it.value().bio;
+        profile.avatarPath = it.value().avatarPath;
+        changed = profiles.put(userId, profile);
+    }
+    if (changed) {
+        publishReadState();
+    }
+
+    if (!directoryBuilt) {
+        return; // Picked up when the search index is first built
+    }
+    if (it == userMap.constEnd()) {
+        directory.remove(findUserHandle(userId));
+    } else {
+        directory.put(userHandle(userId), it.value().nickname, userId);
+    }
+}
+
+QVector<QPair<QString, QString>> server::searchUsers(const QString &query, int limit) {
+    if (!directoryBuilt) {
+        for (auto it = userMap.constBegin(); it != userMap.constEnd(); ++it) {
+            directory.put(userHandle(it.key()), it.value().nickname, it.key());
+        }
+        directoryBuilt = true;
+        qDebug() << "Built user directory index for" << directory.size() << "users";
+    }
+
+    QVector<QPair<QString, QString>> users;
+    UserIds *ids = UserIds::getInstance();
+    for (UserHandle handle : directory.search(query, limit)) {
+        QString userId = ids->idOf(handle);
+        auto it = userMap.constFind(userId);
+        if (it != userMap.constEnd()) {
+            users.append(qMakePair(userId, it.value().nickname));
+        }
+    }
+    return users;
+}
+
+void server::republishBlocks(UserHandle user) {
+    HandleSet blocked = social.edgesOf(SocialGraph::Block, user);
+    if (blocked.isEmpty()) {
+        publishedBlocks.remove(user);
+    } else {
+        publishedBlocks.insert(user, QSharedPointer<const HandleSet>(new HandleSet(blocked)));
+    }
+}
+
+void server::publishReadState() {
+    // The profile snapshot is shared and immutable. Stories are published
+    // as one immutable header per story, reused until that story changes,
+    // so the owner's own containers are never shared with readers and its
+    // writes never detach them.
+    if (storiesChanged) {
+        QHash<QString, QSharedPointer<const StoryData>> previous;
+        for (const QSharedPointer<const StoryData> &header : publishedStories) {
+            previous.insert(header->id, header);
+        }
+        QVector<QSharedPointer<const StoryData>> headers;
+        headers.reserve(stories.size());
+        for (const StoryData &story : stories) {
+            QSharedPointer<const StoryData> header = previous.value(story.id);
+            if (!header) {
+                StoryData *copy = new StoryData(story);
+                copy->viewers = StoryViewers();
+                header = QSharedPointer<const StoryData>(copy);
+            }
+            headers.append(header);
+        }
+        publishedStories = headers;
+        storiesChanged = false;
+    }
+
+    ServerReadState *state = new ServerReadState;
+    state->version = publishedVersion.fetchAndAddOrdered(1) + 1;
+    state->profiles = profiles.view();
+    state->blocks = publishedBlocks;
+    state->stories = publishedStories;
+    published.publish(state);
+}
+
+void server::postMutation(std::function<void()> mutation) {
+    if (QThread::currentThread() == ownerThread) {
+        mutation();
+        return;
+    }
+
+    bool wasEmpty;
+    {
+        QMutexLocker locker(&mutationLock);
+        wasEmpty = mutationQueue.isEmpty();
+        mutationQueue.append(std::move(mutation));
+    }
+    // One wake-up per batch; the owner drains everything queued by then
+    if (wasEmpty && QCoreApplication::instance()) {
+        QMetaObject::invokeMethod(QCoreApplication::instance(),
+                                  [this]() { applyPendingMutations(); },
+                                  Qt::QueuedConnection);
+    }
+}
+
+std::function<void(std::function<void()>)> server::executor() {
+    return [this](std::function<void()> job) { postMutation(std::move(job)); };
+}
+
+ServerCall<PostResult> server::sendMessage(const QString &senderId, const QString &recipientId,
+                                           const QString &body) {
+    return ServerCall<PostResult>(executor(), [this, senderId, recipientId, body]() {
+        return postMessage(senderId, recipientId, body);
+    });
+}
+
+ServerCall<QVector<Message>> server::loadRoomPage(const QString &roomId, quint64 beforeSeq,
+                                                  int limit) {
+    return ServerCall<QVector<Message>>(executor(), [this, roomId, beforeSeq, limit]() {
+        hydrateRoom(roomId);
+        return roomLogs.acquire(roomId)->getMessagesBefore(beforeSeq, limit);
+    });
+}
+
+ServerCall<Client*> server::login(const QString &email, const QString &password) {
+    return ServerCall<Client*>(executor(), [this, email, password]() {
+        return loginUser(email, password);
+    });
+}
+
+void server::applyPendingMutations() {
+    QVector<std::function<void()>> batch;
+    {
+        QMutexLocker locker(&mutationLock);
+        batch.swap(mutationQueue);
+    }
+    for (const std::function<void()> &mutation : batch) {
+        mutation();
+    }
+}
@@ -3,6 +3,7 @@
 #define SERVER_H
 
 #include <QMap>
+#include <QHash>
 #include <QString>
 #include <QFile>
 #include <QTextStream>
@@ -14,6 +15,23 @@
 #include <QDir>
 #include <QSet>
 #include "../client/client.h"
+#include "presence.h"
+#include "ephemeral.h"
+#include "messageindex.h"
+#include "userdirectory.h"
+#include "profilestore.h"
+#include "rcu.h"
+#include "roomshards.h"
+#include "taskpool.h"
+#include "servercall.h"
+#include "latencyhistogram.h"
+#include "socialgraph.h"
+#include "storyviewers.h"
+#include <QElapsedTimer>
+#include <QAtomicInteger>
+#include <QSharedPointer>
+#include <QMutex>
+#include <functional>
 #include <QList>
 
 struct UserData {
@@ -21,8 +39,8 @@ struct UserData {
     QString password;
     QString bio;
     QString nickname;
-    bool isOnline;
-    QDateTime lastStatusChange; // Track when online status last changed
+    bool isOnline;              // The user's "appear online" choice; actual presence comes from heartbeats
+    QDateTime lastStatusChange; // Track when online status last changed (persisted lazily)
     QString avatarPath;         // Path to user's avatar image
 };
 
@@ -33,8 +51,105 @@ struct StoryData {
     QString imagePath;    // Path to the story image
     QString caption;      // Caption text
     QDateTime timestamp;  // When the story was created
-    QSet<QString> viewers; // Set of userIds who have viewed this story
-    QMap<QString, QDateTime> viewTimes; // Map of userId -> time when they viewed the story
+    StoryViewers viewers; // Who has viewed this story, and when
+};
+
+// One row of a user's inbox: the latest state of a conversation
+struct InboxEntry {
+    QString roomId;         // Room the conversation lives in
+    QString peerId;         // The other participant
+    QString lastMessage;    // Preview of the newest message
+    QString lastSender;     // Who sent the newest message
+    QDateTime lastActivity; // When the newest message was sent
+    quint64 lastSeq = 0;    // Sequence number of the newest message
+    int unreadCount = 0;    // Messages past this user's read watermark
+};
+
+// One result of searchMessages, best match first
+struct MessageSearchHit {
+    QString roomId;  // Room the message lives in
+    QString peerId;  // The other participant
+    Message message; // The message itself; getSeq() locates it in the room
+    double score = 0;
+};
+
+// Outcome of server::postMessage
+struct PostResult {
+    enum Status {
+        Posted,
+        EmptyBody,
+        UnknownSender,
+        UnknownRecipient,
+        Blocked, // One of the two has blocked the other
+        NoRoom   // Sender is not signed in and the pair has no room yet
+    };
+    Status status = Posted;
+    QString roomId;
+    quint64 seq = 0;
+    bool ok() const { return status == Posted; }
+};
+
+// Stages of the message post pipeline, each timed into its own histogram
+enum PostStage {
+    PostValidate, // Users exist, nobody is blocked
+    PostSequence, // Resolve or create the room, assign the sequence number
+    PostPersist,  // Hand the line to the room's shard
+    PostIndex,    // Update loaded search indexes
+    PostFanOut,   // Read marks, recipient's contact and room, inboxes
+    PostNotify,   // Activity times, typing indicator
+    PostTotal,    // The whole post, end to end
+    POST_STAGE_COUNT
+};
+
+// Ordering key for the recent-conversations index: newest activity first,
+// room ID breaks ties so every key is unique
+struct ActivityKey {
+    qint64 activityMs;
+    QString roomId;
+
+    bool operator<(const ActivityKey &other) const {
+        if (activityMs != other.activityMs) {
+            return activityMs > other.activityMs;
+        }
+        return roomId < other.roomId;
+    }
+};
+
+// Approximate resident bytes per subsystem, as reported by memoryUsage()
+struct MemoryUsage {
+    qint64 roomLogBytes = 0;   // Loaded message histories (records + text)
+    int loadedRoomLogs = 0;
+    qint64 clientBytes = 0;    // Client objects and their room views
+    int residentClients = 0;
+    qint64 inboxBytes = 0;     // Inbox rows and recent-conversation indexes
+    qint64 directoryBytes = 0; // Room directory and per-user room lists
+    qint64 searchIndexBytes = 0; // Per-user message search indexes
+
+    qint64 total() const {
+        return roomLogBytes + clientBytes + inboxBytes + directoryBytes + searchIndexBytes;
+    }
+};
+
+// Read-mostly server state as one immutable version. Published after every
+// change to profiles, block lists or stories; readers on any thread hold an
+// RcuSnapshot while they use it and never block the writer.
+struct ServerReadState {
+    quint64 version = 0;
+    ProfileStore::View profiles; // Email -> profile
+    // Who each user has blocked. Each set is shared and immutable, so a
+    // block or unblock republishes only that user's set. Contacts are not
+    // published; they are only read on the owner thread.
+    QHash<UserHandle, QSharedPointer<const HandleSet>> blocks;
+    // Story headers, one immutable copy each; viewers stay with the owner,
+    // so a view never republishes or copies anything here
+    QVector<QSharedPointer<const StoryData>> stories;
+
+    const UserProfile *profile(const QString &userId) const { return profiles.find(userId); }
+    // Handles never change once assigned, so callers may resolve them ahead
+    bool isBlocked(UserHandle user, UserHandle other) const {
+        auto it = blocks.constFind(user);
+        return it != blocks.constEnd() && it.value()->contains(other);
+    }
 };
 
 class server {
@@ -52,29 +167,140 @@ private:
     // Data storage
     QMap<QString, UserData> userMap;                      // Email -> UserData
     QMap<QString, Client*> clients;                       // Email -> Client pointer
-    QMap<QString, QVector<QString>> userContacts;         // UserId -> Contact list
-    QMap<QString, QMap<QString, Room*>> userRooms;        // UserId -> (RoomId -> Room*)
-    QMap<QString, QList<Message>> roomMessages;          // RoomId -> Messages (changed from QStack to QList)
+    QHash<UserHandle, QVector<QString>> userContacts;     // User -> Contact list
+    QHash<UserHandle, QMap<QString, Room*>> userRooms;    // User -> (RoomId -> Room*); owns the Rooms, clients only view them
+    RoomLogStore &roomLogs;                               // RoomId -> shared message log
+    RoomShards roomShards;                                // Room file writes, one worker per shard
+    TaskPool jobs;                                        // Background work: rebuilds, file cleanup, index tokenizing
     QVector<StoryData> stories;                           // All stories
-    QMap<QString, QVector<QString>> blockedUsers;           // Add this line for blocked users
+    // Contacts and blocks. userContacts stays the ordered, persisted list;
+    // the graph answers membership in O(1) for sends and fan-out. Blocks live
+    // only in the graph and are written as +/- deltas to each _blocked.txt.
+    SocialGraph social;
+    QHash<UserHandle, int> blockFileLines; // Lines in each user's _blocked.txt
+    void appendBlockDelta(const QString &userId, QChar op, const QString &otherId);
+    void compactBlockFile(const QString &userId);
+    void setContacts(const QString &userId, const QVector<QString> &contacts);
+    QHash<RoomKey, QHash<UserHandle, quint64>> roomReadMarks; // Room -> (user -> read up to seq)
+    QHash<UserHandle, QMap<QString, InboxEntry>> userInbox;   // User -> (RoomId -> inbox row)
+    QHash<UserHandle, QMap<ActivityKey, QString>> userRecent; // User -> (activity order -> RoomId)
+    QHash<RoomKey, QString> roomDirectory;                    // Participant key -> RoomId as stored on disk
+    QHash<UserHandle, QVector<RoomKey>> roomsByUser;          // User -> keys of every room they are in
+
+    // Lazy hydration: startup loads only the user directory; a user's
+    // contacts, rooms and inbox are loaded at login, room contents on first use
+    QSet<QString> hydratedUsers;
+    QSet<QString> hydratedRooms;
+
+    // Memory budget: cold room logs are spilled to disk and idle clients
+    // dropped once the estimated resident size goes past it
+    qint64 memoryBudget;
+    QHash<QString, qint64> clientLastActive; // UserId -> ms since epoch of last activity
+    int operationsSinceTrim;                 // Budget is checked every few messages
+
+    // Presence: heartbeats with TTL expiry, never written on the hot path.
+    // Status-change times are copied into userMap and flushed in batches.
+    PresenceEngine presence;
+    QSet<QString> pendingPresenceWrites; // Users whose LAST_CHANGE is not on disk yet
+    qint64 lastPresenceFlushMs;
+    qint64 lastRoomMetaFlushMs;  // When the presence tick last wrote read watermarks
+    void applyPresenceChanges();
+
+    // Typing indicators: throttled, self-expiring and never persisted
+    EphemeralChannel typing;
+
+    // Post pipeline stages, in the order postMessage runs them
+    LatencyHistogram postStageLatency[POST_STAGE_COUNT];
+    quint64 postsSinceReport;
+    void recordStage(PostStage stage, QElapsedTimer &timer);
+    quint64 storeMessage(const QString &roomId, const Message &message, QElapsedTimer &stage);
+    void fanOutMessage(const QString &roomId, const QString &senderId, quint64 seq);
+    void notifyMessage(const QString &roomId, const QString &senderId);
+    Room *resolveRoomForPost(const QString &senderId, const QString &recipientId, QString &roomId);
+    void mirrorRoomForRecipient(const QString &recipientId, const QString &senderId,
+                                const QString &roomId, const QString &roomName);
+
+    // Stories expire on the presence tick; their files are removed as
+    // background jobs
+    qint64 lastStoryExpiryMs;
+    void removeFilesLater(const QStringList &paths);
+    // Binary viewer log beside each story's .meta: rewritten on save, one
+    // record appended per view. Both run pinned to the story, in order.
+    static QString storyViewersPath(const QString &storyId) {
+        return "../db/stories/" + storyId + ".viewers";
+    }
+    void saveStoryViewers(const StoryData &story);
+    void appendStoryView(const QString &storyId, const QString &viewerId, quint16 offset);
+    void removeStoryViewersLater(const QString &storyId);
+    static int storyAffinity(const QString &storyId) { return int(qHash(storyId) & 0x7FFFFFFF); }
+
+    // Message search: one inverted index per user, built on their first
+    // search and then kept current as messages are appended
+    QHash<UserHandle, MessageIndex> messageIndexes;
+    MessageIndex &messageIndexFor(const QString &userId);
+    QVector<QStringList> tokenizeMessages(const QVector<QString> &texts); // Spread over the pool when large
+    void indexMessage(const QString &roomId, quint64 seq, const QString &text);
+    void dropMessageIndexes(const QString &roomId); // History rewritten: rebuild on next search
+
+    // User search index, built on the first searchUsers call and kept in
+    // step with registrations, nickname changes and deletions after that
+    UserDirectory directory;
+    bool directoryBuilt;
+
+    // Profiles for hot-path reads (settings, avatars, presence handles),
+    // mirrored from userMap into a perfect-hash snapshot
+    ProfileStore profiles;
+    void syncUserIndexes(const QString &userId); // userMap entry changed
+
+    // Concurrent readers see published versions only. Every write happens on
+    // the thread that created the server; other threads queue mutations.
+    RcuPointer<ServerReadState> published;
+    QAtomicInteger<quint64> publishedVersion;
+    // Headers last published; rebuilt only after storiesChanged is set
+    QVector<QSharedPointer<const StoryData>> publishedStories;
+    bool storiesChanged;
+    QHash<UserHandle, QSharedPointer<const HandleSet>> publishedBlocks;
+    void republishBlocks(UserHandle user); // Refresh one user's published block set
+    void publishReadState();
+    QThread *ownerThread;
+    QMutex mutationLock;
+    QVector<std::function<void()>> mutationQueue; // Guarded by mutationLock
+    std::function<void(std::function<void()>)> executor(); // postMutation, for ServerCall
     
+    // Dirty tracking, so shutdown only writes what this session changed
+    bool credentialsDirty;         // credentials.txt is out of date
+    QSet<QString> dirtySettings;   // Users whose settings file is out of date
+    QSet<QString> dirtyUserFiles;  // Users whose contacts/rooms file is out of date
+    QSet<QString> dirtyRoomMeta;   // Rooms whose read watermarks file is out of date
+
     Client* currentClient;  // Currently logged in client
 
     // File loading and saving
     void loadUsersAccounts();
     void saveUsersAccounts();
     void loadUserContacts(const QString& userId);
+    void loadBlockedUsers(const QString& userId);
+    void hydrateUser(const QString& userId);   // Contacts, rooms and inbox, once per user
+    void hydrateRoom(const QString& roomId);   // Messages and watermarks, once per room
+    void evictClient(const QString& userId);   // Save and drop an idle client
+    void dropUserRooms(UserHandle user);       // Delete the user's Room objects
     void saveUserContacts(const QString& userId);
     void loadClientData(Client* client);
     void saveClientData(Client* client);
     void migrateRoomFiles();
     void loadAllData();
-    void saveAllData();
+    void saveAllData();      // Rewrite everything (full repair)
+    void saveChangedData();  // Write only dirty entities
+    void saveUserSettingsFile(const QString &email);
     void createDefaultSettingsFiles();
     void loadStories();  // Load stories from disk
     void saveStories();  // Save stories to disk
     void updateRoomReferencesInUserFiles(const QString &oldRoomId, const QString &newRoomId); // Update room references in user files
     void fixUserContactsFile(const QString &userId); // Fix room references in a user's contact file
+    void loadRoomMeta(const QString &roomId);  // Load read watermarks for a room
+    void saveRoomMeta(const QString &roomId);  // Persist read watermarks for a room
+    void flushRoomMeta();                      // Persist every moved watermark
+    void indexRoomFile(const QString &roomId);       // Add an on-disk room to the room directory
 
 public:
     // Destructor
@@ -83,6 +309,19 @@ public:
     // Method to access the singleton instance
     static server* getInstance();
     
+    // Canonical form of a user ID (email): trimmed and lower-cased.
+    // Every ID is passed through this once where it enters the system.
+    static QString normalizeUserId(const QString &userId) { return userId.trimmed().toLower(); }
+
+    // Integer handle for an (already canonical) user ID; the core keys its
+    // maps on these. findUserHandle returns 0 instead of interning.
+    static UserHandle userHandle(const QString &userId) {
+        return UserIds::getInstance()->intern(userId);
+    }
+    static UserHandle findUserHandle(const QString &userId) {
+        return UserIds::getInstance()->find(userId);
+    }
+
     // Validation methods
     bool isValidEmail(const QString& email);
     bool isValidPassword(const QString& password);
@@ -98,16 +337,42 @@ public:
     Client* loginUser(const QString& email, const QString& password);
     void logoutUser();
     Client* getCurrentClient() const { return currentClient; }
-    QVector<QPair<QString, QString>> getAllUsers() const;
+
+    // User directory as (email, nickname) pairs. listUsers pages through it
+    // in email order: pass "" for the first page, then the nextCursor it
+    // returned; nextCursor comes back empty after the last page.
+    QVector<QPair<QString, QString>> listUsers(const QString &cursor, int limit,
+                                               QString *nextCursor = nullptr) const;
+    // Just the given users, skipping unknown IDs
+    QVector<QPair<QString, QString>> lookupUsers(const QVector<QString> &userIds) const;
     QString getUsernameById(const QString &email) const;
     bool deleteUser(const QString &userId);
     
     // User settings management
     bool updateUserSettings(const QString &userId, const QString &nickname, const QString &bio);
+    // Reads the published state (readState), so any thread may call it
     bool getUserSettings(const QString &userId, QString &nickname, QString &bio, QString &avatarPath);
     bool getUserSettings(const QString &userId, QString &nickname, QString &bio); // Old version for backward compatibility
     bool setUserOnlineStatus(const QString &userId, bool isOnline);
     bool isUserOnline(const QString &userId) const;
+
+    // Presence heartbeats: a signed-in client calls heartbeat() every
+    // PRESENCE_HEARTBEAT_MS; users whose heartbeats stop go offline after
+    // the TTL. tickPresence() expires them and flushes status times in batches.
+    static const int PRESENCE_HEARTBEAT_MS = 3000;
+    void heartbeat(const QString &userId);
+    void tickPresence();
+
+    // Presence subscriptions: a session names the users it is showing
+    // (contacts, visible rows) and then drains only their status changes,
+    // userId -> online, instead of polling everybody
+    void setPresenceInterests(const QString &watcherId, const QVector<QString> &userIds);
+    QHash<QString, bool> takePresenceUpdates(const QString &watcherId);
+
+    // Typing indicators for the chat between two users. Safe to call on
+    // every keystroke; events are throttled and expire without a "stopped".
+    bool setTyping(const QString &userId, const QString &peerId, bool isTyping);
+    bool isUserTyping(const QString &typerId, const QString &peerId) const;
     
     // Avatar management
     bool updateUserAvatar(const QString &userId, const QString &avatarPath);
@@ -134,6 +399,13 @@ public:
     // Room management
     bool addRoomToUser(const QString &userId, Room *room);
     bool hasRoomForUser(const QString &userId, const QString &roomId);
+
+    // Room directory: O(1) lookup of the room shared by two users, built once
+    // at startup so resolving a room never touches the filesystem
+    QString findRoomId(RoomKey key) const { return roomDirectory.value(key); }
+    QString findRoomId(const QString &userA, const QString &userB) const;
+    void registerRoom(RoomKey key, const QString &roomId);
+    bool hasRoom(const QString &roomId) const;
     
     // Story management
     QString addStory(const QString &userId, const QString &imagePath, const QString &caption);
@@ -153,7 +425,67 @@ public:
     
     // Message management
     void updateRoomMessages(const QString &roomId, const QVector<Message> &messages);
+    // Edit one message in place; it keeps its position and sequence number
+    bool editMessage(const QString &roomId, quint64 seq, const QString &content);
     QVector<Message> getRoomMessages(const QString &roomId) const;
+    quint64 getRoomLastSeq(const QString &roomId) const;
+
+    // Read watermarks: each participant has read everything up to a sequence number
+    quint64 getReadWatermark(const QString &roomId, const QString &userId) const;
+    bool markRoomRead(const QString &roomId, const QString &userId, quint64 seq);
+    int getUnreadCount(const QString &roomId, const QString &userId) const;
+    bool isMessageRead(const QString &roomId, const QString &readerId, quint64 seq) const {
+        return seq != 0 && seq <= getReadWatermark(roomId, readerId);
+    }
+
+    // Inbox summary: one row per conversation, kept current as messages arrive
+    void refreshInboxForRoom(const QString &roomId); // Update both participants' inbox rows
+    QVector<InboxEntry> getInbox(const QString &userId) const;
+
+    // Conversations ordered by Room::lastActivity, newest first.
+    // O(log n + offset + limit) per call; limit < 0 returns everything after offset.
+    QVector<InboxEntry> recentConversations(const QString &userId, int offset, int limit) const;
+
+    // Full-text search over a user's conversations. Every query word must
+    // match (case-insensitively); results are ranked and paged by offset.
+    QVector<MessageSearchHit> searchMessages(const QString &userId, const QString &query,
+                                             int limit, int offset = 0);
+
+    // Thread-safe reads: the latest published state, valid while the
+    // returned snapshot lives. Callable from any thread.
+    typedef RcuSnapshot<ServerReadState> ReadSnapshot;
+    ReadSnapshot readState() const { return ReadSnapshot(published); }
+    quint64 readStateVersion() const { return publishedVersion.loadAcquire(); }
+
+    // Writes from other threads: queued and applied in order on the owner
+    // thread, which then publishes a new read state
+    void postMutation(std::function<void()> mutation);
+    void applyPendingMutations();
+
+    // Awaitable forms of the core operations, for UI coroutines (UiTask).
+    // Each runs on the server's executor and resumes the caller on the Qt
+    // event loop, so UI code stays straight-line:
+    //     PostResult posted = co_await srv->sendMessage(me, peer, text).resumeOn(this);
+    // sendMessage is postMessage, so it validates and checks blocks the same way.
+    ServerCall<PostResult> sendMessage(const QString &senderId, const QString &recipientId,
+                                       const QString &body);
+    // Up to limit messages before beforeSeq (0: the newest), oldest first
+    ServerCall<QVector<Message>> loadRoomPage(const QString &roomId, quint64 beforeSeq, int limit);
+    ServerCall<Client*> login(const QString &email, const QString &password);
+
+    // Live user search: (email, nickname) pairs whose nickname words or email
+    // start with query, then emails containing it. Cost follows the matches,
+    // not the directory size.
+    QVector<QPair<QString, QString>> searchUsers(const QString &query, int limit);
+
+    // Memory budget and accounting
+    void setMemoryBudget(qint64 bytes) { memoryBudget = bytes; enforceMemoryBudget(); }
+    qint64 getMemoryBudget() const { return memoryBudget; }
+    MemoryUsage memoryUsage() const;
+    void enforceMemoryBudget();
+
+    // Queue depths and steal counts of the background job pool
+    TaskPool::Stats jobStats() const { return jobs.stats(); }
 
     // Application shutdown handler
     void shutdown() {
@@ -169,18 +501,20 @@ public:
     // Add method to unblock user
     bool unblockUserForClient(const QString &clientId, const QString &userToUnblock);
 
-    // Add method to check if a user is blocked
+    // Add method to check if a user is blocked; reads the published state
     bool isUserBlocked(const QString &clientId, const QString &userToCheck) const;
 
     // Add method to get blocked users
     QVector<QString> getBlockedUsers(const QString &clientId) const;
 
-    // Add new messages to room list (changed from stack)
-    void addMessageToRoom(const QString &roomId, const Message &message);
-    
-    // Convert between QList and QVector for compatibility (changed from QStack)
-    QVector<Message> getMessageVectorFromList(const QString &roomId) const;
-    void setMessageListFromVector(const QString &roomId, const QVector<Message> &messages);
+    // Send a direct message: the one path for validation, room creation,
+    // persistence, indexing, fan-out to the recipient and notification
+    PostResult postMessage(const QString &senderId, const QString &recipientId,
+                           const QString &body);
+
+    // Per-stage latency of every post since startup
+    const LatencyHistogram &postLatency(PostStage stage) const { return postStageLatency[stage]; }
+    QString postLatencyReport() const;
 
     // Repair methods
     void repairInconsistentRoomFiles(); // Repair room files that might use nicknames instead of emails
@@ -0,0 +1,119 @@
+// servercall.h
+#ifndef SERVERCALL_H
+#define SERVERCALL_H
+
+#include <QAtomicInteger>
+#include <QCoreApplication>
+#include <QDebug>
+#include <QMetaObject>
+#include <QObject>
+#include <QPointer>
+#include <coroutine>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <type_traits>
+
+// Return type for UI coroutines: starts running at once and owns itself,
+// so a slot can simply call it and forget about it.
+//
+//     UiTask ChatPage::loadOlderMessages() {
+//         QVector<Message> page = co_await srv->loadRoomPage(id, seq, n).resumeOn(this);
+//         ...
+//     }
+class UiTask {
+public:
+    struct promise_type {
+        UiTask get_return_object() { return UiTask(); }
+        std::suspend_never initial_suspend() noexcept { return {}; }
+        std::suspend_never final_suspend() noexcept { return {}; }
+        void return_void() {}
+        void unhandled_exception() { qDebug() << "Unhandled exception in a UI coroutine"; }
+    };
+};
+
+// One server operation, awaitable from a UI coroutine. The operation runs on
+// the server's executor (its owning thread); the coroutine then resumes on
+// the Qt event loop of its context object. If the context is destroyed in
+// the meantime the coroutine is never resumed, so it cannot touch a dead
+// widget; its frame is destroyed instead, so its locals are not leaked.
+// When the operation finishes before the coroutine has suspended (the
+// executor ran it inline), the coroutine simply carries on.
+template <class T>
+class ServerCall {
+    static_assert(!std::is_void<T>::value, "ServerCall needs a result type");
+
+public:
+    typedef std::function<void(std::function<void()>)> Executor;
+
+    ServerCall(Executor executor, std::function<T()> operation)
+        : executor(std::move(executor)), operation(std::move(operation)),
+          context(QCoreApplication::instance()), state(Pending) {}
+    // Moved only before it is awaited, so there is no result or state to carry
+    ServerCall(ServerCall &&other)
+        : executor(std::move(other.executor)), operation(std::move(other.operation)),
+          context(other.context), state(Pending) {}
+
+    // Resume on this object's thread, and only while it is alive
+    ServerCall resumeOn(QObject *object) && {
+        context = object;
+        return std::move(*this);
+    }
+
+    bool await_ready() const noexcept { return false; }
+
+    bool await_suspend(std::coroutine_handle<> awaiting) {
+        executor([this, awaiting]() {
+            result = operation();
+            if (state.testAndSetOrdered(Pending, Done)) {
+                return; // Finished before the coroutine suspended
+            }
+            state.storeRelease(Done);
+            // The executor is the thread the context lives on, so the
+            // guarded pointer can be read here
+            QObject *target = context.data();
+            if (!target) {
+                qDebug() << "Dropping a server result: its receiver is gone";
+                awaiting.destroy(); // Frees this awaiter too; touch nothing after
+                return;
+            }
+            // Qt discards a queued functor whose target dies before delivery;
+            // the guard then goes with it and destroys the frame
+            auto guard = std::make_shared<ResumeGuard>(awaiting);
+            QMetaObject::invokeMethod(target, [guard]() { guard->resume(); },
+                                      Qt::QueuedConnection);
+        });
+        // False resumes the coroutine right here, with the result in hand
+        return state.testAndSetOrdered(Pending, Suspended);
+    }
+
+    T await_resume() { return std::move(*result); }
+
+private:
+    enum State { Pending = 0, Suspended = 1, Done = 2 };
+
+    // Owns a suspended coroutine until it is resumed
+    struct ResumeGuard {
+        explicit ResumeGuard(std::coroutine_handle<> handle) : handle(handle) {}
+        ~ResumeGuard() {
+            if (handle) {
+                qDebug() << "Dropping a server result: its receiver went away";
+                handle.destroy();
+            }
+        }
+        void resume() {
+            std::coroutine_handle<> resuming = handle;
+            handle = nullptr;
+            resuming.resume();
+        }
+        std::coroutine_handle<> handle;
+    };
+
+    Executor executor;
+    std::function<T()> operation;
+    QPointer<QObject> context;
+    std::optional<T> result;
+    QAtomicInteger<int> state;
+};
+
+#endif // SERVERCALL_H
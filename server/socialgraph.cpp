@@ -0,0 +1,66 @@
+// socialgraph.cpp
+#include "socialgraph.h"
+
+bool SocialGraph::add(Relation relation, UserHandle from, UserHandle to) {
+    if (from == 0 || to == 0) {
+        return false;
+    }
+    return edges[relation][from].insert(to);
+}
+
+bool SocialGraph::remove(Relation relation, UserHandle from, UserHandle to) {
+    auto it = edges[relation].find(from);
+    if (it == edges[relation].end() || !it.value().remove(to)) {
+        return false;
+    }
+    if (it.value().isEmpty()) {
+        edges[relation].erase(it);
+    }
+    return true;
+}
+
+QVector<UserHandle> SocialGraph::targets(Relation relation, UserHandle from) const {
+    auto it = edges[relation].constFind(from);
+    return it != edges[relation].constEnd() ? it.value().toVector() : QVector<UserHandle>();
+}
+
+int SocialGraph::degree(Relation relation, UserHandle from) const {
+    auto it = edges[relation].constFind(from);
+    return it != edges[relation].constEnd() ? it.value().size() : 0;
+}
+
+void SocialGraph::replace(Relation relation, UserHandle from, const QVector<UserHandle> &to) {
+    edges[relation].remove(from);
+    for (UserHandle target : to) {
+        add(relation, from, target);
+    }
+}
+
+void SocialGraph::clear(Relation relation, UserHandle from) {
+    edges[relation].remove(from);
+}
+
+void SocialGraph::removeUser(UserHandle user) {
+    for (int relation = 0; relation < RELATION_COUNT; ++relation) {
+        edges[relation].remove(user);
+        // Incoming edges: rare (account deletion), so a full pass is fine
+        for (auto it = edges[relation].begin(); it != edges[relation].end();) {
+            it.value().remove(user);
+            if (it.value().isEmpty()) {
+                it = edges[relation].erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+}
+
+qint64 SocialGraph::residentBytes() const {
+    qint64 bytes = 0;
+    for (int relation = 0; relation < RELATION_COUNT; ++relation) {
+        for (const HandleSet &set : edges[relation]) {
+            bytes += sizeof(UserHandle) + sizeof(HandleSet) + set.residentBytes();
+        }
+    }
+    return bytes;
+}
@@ -0,0 +1,50 @@
+// socialgraph.h
+#ifndef SOCIALGRAPH_H
+#define SOCIALGRAPH_H
+
+#include <QHash>
+#include <QVector>
+#include <QtGlobal>
+#include "handleset.h"
+
+// Directed user-to-user relations over interned handles: who has whom as a
+// contact, who blocked whom. Every check is a hash probe on the source user
+// and one on their set, so it can run on every send and every fan-out.
+// Implicitly shared, so copying it into a published snapshot costs nothing
+// until the next write.
+class SocialGraph {
+public:
+    enum Relation {
+        Contact = 0,
+        Block = 1
+    };
+    static const int RELATION_COUNT = 2;
+
+    bool add(Relation relation, UserHandle from, UserHandle to);
+    bool remove(Relation relation, UserHandle from, UserHandle to);
+    bool has(Relation relation, UserHandle from, UserHandle to) const {
+        auto it = edges[relation].constFind(from);
+        return it != edges[relation].constEnd() && it.value().contains(to);
+    }
+    // Either user has blocked the other
+    bool blockedEitherWay(UserHandle a, UserHandle b) const {
+        return has(Block, a, b) || has(Block, b, a);
+    }
+
+    QVector<UserHandle> targets(Relation relation, UserHandle from) const;
+    // from's outgoing edges as a set; implicitly shared, so this is cheap
+    HandleSet edgesOf(Relation relation, UserHandle from) const {
+        return edges[relation].value(from);
+    }
+    int degree(Relation relation, UserHandle from) const;
+    void replace(Relation relation, UserHandle from, const QVector<UserHandle> &to);
+    void clear(Relation relation, UserHandle from); // Drop from's outgoing edges
+    void removeUser(UserHandle user);               // Drop every edge touching user
+
+    qint64 residentBytes() const;
+
+private:
+    QHash<UserHandle, HandleSet> edges[RELATION_COUNT];
+};
+
+#endif // SOCIALGRAPH_H
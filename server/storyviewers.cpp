@@ -0,0 +1,96 @@
+// storyviewers.cpp
+#include "storyviewers.h"
+#include <QDataStream>
+#include <QIODevice>
+#include <algorithm>
+
+bool StoryViewers::record(UserHandle viewer, qint64 secsSincePost) {
+    if (viewer == 0) {
+        return false;
+    }
+    quint16 offset = clampOffset(secsSincePost);
+    if (!viewers.insert(viewer)) {
+        offsets[viewers.rank(viewer)] = offset;
+        return false;
+    }
+    // Its rank after the insert is its slot in the parallel array
+    offsets.insert(viewers.rank(viewer), offset);
+    return true;
+}
+
+int StoryViewers::offsetOf(UserHandle viewer) const {
+    if (!viewers.contains(viewer)) {
+        return -1;
+    }
+    return offsets[viewers.rank(viewer)];
+}
+
+QVector<StoryViewers::View> StoryViewers::views() const {
+    const QVector<UserHandle> handles = viewers.toVector();
+    QVector<View> result;
+    result.reserve(handles.size());
+    for (int i = 0; i < handles.size(); ++i) {
+        result.append(View(handles[i], offsets[i]));
+    }
+    return result;
+}
+
+void StoryViewers::assign(QVector<View> log) {
+    std::stable_sort(log.begin(), log.end(),
+                     [](const View &a, const View &b) { return a.first < b.first; });
+    viewers = HandleSet();
+    offsets.clear();
+    offsets.reserve(log.size());
+    for (int i = 0; i < log.size(); ++i) {
+        if (log[i].first == 0) {
+            continue;
+        }
+        // Runs of one handle are in log order; keep the last
+        if (i + 1 < log.size() && log[i + 1].first == log[i].first) {
+            continue;
+        }
+        viewers.insert(log[i].first);
+        offsets.append(log[i].second);
+    }
+    offsets.squeeze();
+}
+
+qint64 StoryViewers::residentBytes() const {
+    return viewers.residentBytes() + qint64(offsets.capacity()) * qint64(sizeof(quint16));
+}
+
+QByteArray StoryViewers::header() {
+    QByteArray bytes;
+    QDataStream out(&bytes, QIODevice::WriteOnly);
+    out.setVersion(QDataStream::Qt_5_15);
+    out << MAGIC;
+    return bytes;
+}
+
+QByteArray StoryViewers::encode(const QString &viewerId, quint16 offset) {
+    QByteArray bytes;
+    QDataStream out(&bytes, QIODevice::WriteOnly);
+    out.setVersion(QDataStream::Qt_5_15);
+    out << viewerId.toUtf8() << offset;
+    return bytes;
+}
+
+bool StoryViewers::decode(const QByteArray &data, QVector<QPair<QString, quint16>> &out) {
+    QDataStream in(data);
+    in.setVersion(QDataStream::Qt_5_15);
+    quint32 magic = 0;
+    in >> magic;
+    if (in.status() != QDataStream::Ok || magic != MAGIC) {
+        return false;
+    }
+    while (!in.atEnd()) {
+        QByteArray viewerId;
+        quint16 offset = 0;
+        in >> viewerId >> offset;
+        if (in.status() != QDataStream::Ok) {
+            break; // Torn append from a crash: keep what came before
+        }
+        out.append(qMakePair(QString::fromUtf8(viewerId), offset));
+    }
+    return true;
+}
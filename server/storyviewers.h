@@ -0,0 +1,55 @@
+// storyviewers.h
+#ifndef STORYVIEWERS_H
+#define STORYVIEWERS_H
+
+#include <QByteArray>
+#include <QPair>
+#include <QString>
+#include <QVector>
+#include <QtGlobal>
+#include "handleset.h"
+
+// Who has seen one story, and when. Viewers are a HandleSet (a roaring
+// bitmap once the audience is large); view times sit in a parallel array in
+// ascending handle order, as seconds since the story was posted. A story
+// seen by 100k users costs a few hundred KB rather than a string set plus a
+// map of QDateTimes, and the viewer count is a field read.
+class StoryViewers {
+public:
+    static const int MAX_OFFSET_SECS = 0xFFFF; // ~18h; stories expire after one
+
+    typedef QPair<UserHandle, quint16> View;
+
+    // Record a view secsSincePost after posting; a repeat view moves the
+    // time. True if this is the viewer's first view.
+    bool record(UserHandle viewer, qint64 secsSincePost);
+    bool contains(UserHandle viewer) const { return viewers.contains(viewer); }
+    int size() const { return viewers.size(); }
+    bool isEmpty() const { return viewers.isEmpty(); }
+    // Seconds after posting of the viewer's latest view, or -1
+    int offsetOf(UserHandle viewer) const;
+    QVector<View> views() const; // Ascending handle order
+    // Bulk load in log order: later views of a handle win, no per-view shifting
+    void assign(QVector<View> log);
+    qint64 residentBytes() const;
+
+    // On-disk form: a header, then one (viewer ID, offset) record per view.
+    // Handles are per-process, so the file names viewers by ID; a view is
+    // one appended record and load replays them.
+    static QByteArray header();
+    static QByteArray encode(const QString &viewerId, quint16 offset);
+    // False if the header is wrong; a torn last record is dropped
+    static bool decode(const QByteArray &data, QVector<QPair<QString, quint16>> &out);
+
+    static quint16 clampOffset(qint64 secsSincePost) {
+        return quint16(qBound<qint64>(0, secsSincePost, MAX_OFFSET_SECS));
+    }
+
+private:
+    static const quint32 MAGIC = 0x53565731; // "SVW1"
+
+    HandleSet viewers;
+    QVector<quint16> offsets; // offsets[i] belongs to the i-th smallest handle
+};
+
+#endif // STORYVIEWERS_H
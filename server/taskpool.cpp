@@ -0,0 +1,163 @@
+// taskpool.cpp
+#include "taskpool.h"
+#include <QDebug>
+#include <QMutexLocker>
+
+// Which pool worker the current thread is, so tasks that submit more tasks
+// keep them on their own deque
+static thread_local const TaskPool *currentPool = nullptr;
+static thread_local int currentWorker = -1;
+
+TaskPool::TaskPool(int workerCount)
+    : nextWorker(0), running(0), executed(0), steals(0), generation(0), stopping(false) {
+    if (workerCount <= 0) {
+        workerCount = QThread::idealThreadCount();
+    }
+    workerCount = qBound(1, workerCount, 32);
+
+    workers.reserve(workerCount);
+    for (int i = 0; i < workerCount; ++i) {
+        Worker *worker = new Worker();
+        worker->index = i;
+        workers.append(worker);
+    }
+    for (Worker *worker : workers) {
+        worker->thread = QThread::create([this, worker]() { run(worker); });
+        worker->thread->setObjectName(QString("task-worker-%1").arg(worker->index));
+        worker->thread->start();
+    }
+    qDebug() << "Started task pool with" << workerCount << "workers";
+}
+
+TaskPool::~TaskPool() {
+    {
+        QMutexLocker locker(&idleLock);
+        stopping = true;
+        ++generation;
+    }
+    wake.wakeAll();
+
+    for (Worker *worker : workers) {
+        worker->thread->wait();
+        delete worker->thread;
+        delete worker;
+    }
+    workers.clear();
+}
+
+void TaskPool::submit(std::function<void()> task, Priority priority, int affinity) {
+    if (!task) {
+        return;
+    }
+
+    const int count = workers.size();
+    if (affinity >= 0) {
+        Worker *worker = workers[affinity % count];
+        QMutexLocker locker(&worker->lock);
+        worker->pinned[priority].append(std::move(task));
+    } else {
+        int index = currentPool == this ? currentWorker
+                                        : int(quint32(nextWorker.fetchAndAddRelaxed(1)) % quint32(count));
+        Worker *worker = workers[index];
+        QMutexLocker locker(&worker->lock);
+        worker->stealable[priority].append(std::move(task));
+    }
+
+    {
+        QMutexLocker locker(&idleLock);
+        ++generation;
+    }
+    wake.wakeAll();
+}
+
+bool TaskPool::takeOwn(Worker *worker, int priority, std::function<void()> &task) {
+    QMutexLocker locker(&worker->lock);
+    // Pinned tasks keep their order; stealable ones go newest first
+    if (!worker->pinned[priority].isEmpty()) {
+        task = worker->pinned[priority].takeFirst();
+        return true;
+    }
+    if (!worker->stealable[priority].isEmpty()) {
+        task = worker->stealable[priority].takeLast();
+        return true;
+    }
+    return false;
+}
+
+bool TaskPool::steal(Worker *thief, int priority, std::function<void()> &task) {
+    const int count = workers.size();
+    for (int offset = 1; offset < count; ++offset) {
+        Worker *victim = workers[(thief->index + offset) % count];
+        QMutexLocker locker(&victim->lock);
+        // The oldest task: the one its owner would reach last
+        if (!victim->stealable[priority].isEmpty()) {
+            task = victim->stealable[priority].takeFirst();
+            steals.fetchAndAddRelaxed(1);
+            return true;
+        }
+    }
+    return false;
+}
+
+bool TaskPool::findTask(Worker *worker, std::function<void()> &task) {
+    for (int priority = Interactive; priority < PRIORITY_COUNT; ++priority) {
+        if (takeOwn(worker, priority, task) || steal(worker, priority, task)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void TaskPool::run(Worker *worker) {
+    currentPool = this;
+    currentWorker = worker->index;
+
+    for (;;) {
+        quint64 seen;
+        bool stop;
+        {
+            QMutexLocker locker(&idleLock);
+            seen = generation;
+            stop = stopping;
+        }
+
+        std::function<void()> task;
+        if (findTask(worker, task)) {
+            running.fetchAndAddRelaxed(1);
+            task();
+            running.fetchAndAddRelaxed(-1);
+            executed.fetchAndAddRelaxed(1);
+            continue;
+        }
+
+        // Nothing left, and nothing can arrive once we are stopping
+        if (stop) {
+            return;
+        }
+
+        QMutexLocker locker(&idleLock);
+        while (generation == seen && !stopping) {
+            wake.wait(&idleLock);
+        }
+    }
+}
+
+TaskPool::Stats TaskPool::stats() const {
+    Stats result;
+    result.workers = workers.size();
+    result.depths.reserve(workers.size());
+    for (const Worker *worker : workers) {
+        QMutexLocker locker(&worker->lock);
+        int depth = 0;
+        for (int priority = 0; priority < PRIORITY_COUNT; ++priority) {
+            int waiting = worker->stealable[priority].size() + worker->pinned[priority].size();
+            result.queued[priority] += waiting;
+            depth += waiting;
+        }
+        result.depths.append(depth);
+    }
+    result.running = running.loadRelaxed();
+    result.executed = executed.loadRelaxed();
+    result.steals = steals.loadRelaxed();
+    return result;
+}
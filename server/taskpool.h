@@ -0,0 +1,82 @@
+// taskpool.h
+#ifndef TASKPOOL_H
+#define TASKPOOL_H
+
+#include <QAtomicInteger>
+#include <QList>
+#include <QMutex>
+#include <QThread>
+#include <QVector>
+#include <QWaitCondition>
+#include <QtGlobal>
+#include <functional>
+
+// Work-stealing pool for jobs that must not run on the server's own thread:
+// snapshot rebuilds, file cleanup and the like. Each worker keeps its own
+// deques and pops the newest task (warm in its cache); an idle worker steals
+// the oldest task from a busy one. Interactive tasks always run before
+// background ones, so a burst of background jobs delays an interactive task
+// by at most the tasks already running.
+class TaskPool {
+public:
+    enum Priority {
+        Interactive = 0, // Someone is waiting on the result
+        Background = 1   // Soaks up idle cores
+    };
+    static const int PRIORITY_COUNT = 2;
+
+    struct Stats {
+        int workers = 0;
+        int queued[PRIORITY_COUNT] = {0, 0}; // Waiting, by priority
+        QVector<int> depths;                 // Waiting, by worker
+        int running = 0;
+        quint64 executed = 0;
+        quint64 steals = 0; // Tasks run by a worker other than the one queued on
+    };
+
+    // workerCount <= 0 picks one per core; the server passes what the room
+    // shards leave over
+    explicit TaskPool(int workerCount = 0);
+    ~TaskPool(); // Runs everything already queued, then joins the workers
+
+    int workerCount() const { return workers.size(); }
+
+    // Queue a task. With an affinity >= 0 the task stays on that worker
+    // (affinity modulo the worker count) and is never stolen, so tasks with
+    // the same affinity, e.g. a room shard, run one at a time in order.
+    void submit(std::function<void()> task, Priority priority = Background,
+                int affinity = -1);
+
+    Stats stats() const;
+
+private:
+    TaskPool(const TaskPool &) = delete;
+    TaskPool &operator=(const TaskPool &) = delete;
+
+    struct Worker {
+        mutable QMutex lock;
+        QList<std::function<void()>> stealable[PRIORITY_COUNT];
+        QList<std::function<void()>> pinned[PRIORITY_COUNT];
+        QThread *thread = nullptr;
+        int index = 0;
+    };
+
+    bool takeOwn(Worker *worker, int priority, std::function<void()> &task);
+    bool steal(Worker *thief, int priority, std::function<void()> &task);
+    bool findTask(Worker *worker, std::function<void()> &task);
+    void run(Worker *worker);
+
+    QVector<Worker *> workers;
+    QAtomicInteger<int> nextWorker; // Round-robin for outside submitters
+    QAtomicInteger<int> running;
+    QAtomicInteger<quint64> executed;
+    QAtomicInteger<quint64> steals;
+
+    // Sleeping: submitters bump the generation, idle workers wait for it to move
+    QMutex idleLock;
+    QWaitCondition wake;
+    quint64 generation;
+    bool stopping;
+};
+
+#endif // TASKPOOL_H
@@ -0,0 +1,312 @@
+// userdirectory.cpp
+#include "userdirectory.h"
+#include <QPair>
+#include <QSet>
+#include <algorithm>
+
+static bool rankedBefore(int lengthA, UserHandle userA, int lengthB, UserHandle userB) {
+    return lengthA != lengthB ? lengthA < lengthB : userA < userB;
+}
+
+quint32 UserDirectory::child(quint32 node, ushort ch) const {
+    for (quint32 c = nodes[int(node)].firstChild; c != 0; c = nodes[int(c)].nextSibling) {
+        if (nodes[int(c)].ch == ch) {
+            return c;
+        }
+    }
+    return 0;
+}
+
+quint32 UserDirectory::insertKey(const QString &key, UserHandle user) {
+    if (nodes.isEmpty()) {
+        nodes.append(Node()); // Root
+        top.append(QVector<Ranked>());
+    }
+    quint32 node = 0;
+    for (QChar qc : key) {
+        ushort ch = qc.unicode();
+        quint32 next = child(node, ch);
+        if (next == 0) {
+            Node fresh;
+            fresh.ch = ch;
+            fresh.nextSibling = nodes[int(node)].firstChild;
+            next = quint32(nodes.size());
+            nodes.append(fresh);
+            top.append(QVector<Ranked>());
+            nodes[int(node)].firstChild = next;
+        }
+        node = next;
+        // Every prefix of the key can complete to this user
+        rank(node, user, key.size());
+    }
+    return node;
+}
+
+void UserDirectory::rank(quint32 node, UserHandle user, int length) {
+    QVector<Ranked> &list = top[int(node)];
+    for (int i = 0; i < list.size(); ++i) {
+        if (list[i].user == user) {
+            if (list[i].length <= length) {
+                return; // Already listed by a key at least as short
+            }
+            list.removeAt(i);
+            break;
+        }
+    }
+    int pos = 0;
+    while (pos < list.size() && rankedBefore(list[pos].length, list[pos].user, length, user)) {
+        ++pos;
+    }
+    if (pos >= TOP_K) {
+        return;
+    }
+    list.insert(pos, Ranked{length, user});
+    if (list.size() > TOP_K) {
+        list.removeLast();
+    }
+}
+
+void UserDirectory::refill(quint32 node, int depth) {
+    // Breadth-first from a node depth characters down, so a terminal's depth
+    // is its key length and the first one seen for a user is the shortest
+    QHash<UserHandle, int> shortest;
+    QVector<QPair<quint32, int>> queue;
+    queue.append(qMakePair(node, depth));
+    for (int head = 0; head < queue.size(); ++head) {
+        quint32 current = queue[head].first;
+        int length = queue[head].second;
+        auto terminal = terminals.constFind(current);
+        if (terminal != terminals.constEnd()) {
+            for (UserHandle user : terminal.value()) {
+                if (!shortest.contains(user)) {
+                    shortest.insert(user, length);
+                }
+            }
+        }
+        for (quint32 c = nodes[int(current)].firstChild; c != 0; c = nodes[int(c)].nextSibling) {
+            queue.append(qMakePair(c, length + 1));
+        }
+    }
+
+    QVector<Ranked> list;
+    list.reserve(shortest.size());
+    for (auto it = shortest.constBegin(); it != shortest.constEnd(); ++it) {
+        list.append(Ranked{it.value(), it.key()});
+    }
+    std::sort(list.begin(), list.end(), [](const Ranked &a, const Ranked &b) {
+        return rankedBefore(a.length, a.user, b.length, b.user);
+    });
+    if (list.size() > TOP_K) {
+        list.resize(TOP_K);
+    }
+    top[int(node)] = list;
+}
+
+quint32 UserDirectory::findKey(const QString &key) const {
+    if (nodes.isEmpty()) {
+        return 0;
+    }
+    quint32 node = 0;
+    for (QChar qc : key) {
+        node = child(node, qc.unicode());
+        if (node == 0) {
+            return 0;
+        }
+    }
+    return node;
+}
+
+quint64 UserDirectory::trigramAt(const QString &text, int index) {
+    return (quint64(text.at(index).unicode()) << 32) |
+           (quint64(text.at(index + 1).unicode()) << 16) |
+           quint64(text.at(index + 2).unicode());
+}
+
+void UserDirectory::put(UserHandle user, const QString &nickname, const QString &email) {
+    if (user == 0) {
+        return;
+    }
+
+    Entry entry;
+    entry.email = email.toCaseFolded();
+    QString folded = nickname.simplified().toCaseFolded();
+    if (!folded.isEmpty()) {
+        entry.keys.append(folded);
+        QStringList words = folded.split(' ');
+        if (words.size() > 1) {
+            entry.keys.append(words);
+        }
+    }
+    entry.keys.append(entry.email);
+    entry.keys.removeDuplicates();
+
+    auto existing = entries.constFind(user);
+    if (existing != entries.constEnd()) {
+        if (existing.value().keys == entry.keys && existing.value().email == entry.email) {
+            return; // Nothing changed
+        }
+        remove(user);
+    }
+
+    for (const QString &key : entry.keys) {
+        terminals[insertKey(key, user)].append(user);
+    }
+    QSet<quint64> seen;
+    for (int i = 0; i + 3 <= entry.email.size(); ++i) {
+        quint64 gram = trigramAt(entry.email, i);
+        if (!seen.contains(gram)) {
+            seen.insert(gram);
+            trigrams[gram].append(user);
+        }
+    }
+    entries.insert(user, entry);
+}
+
+void UserDirectory::remove(UserHandle user) {
+    auto it = entries.find(user);
+    if (it == entries.end()) {
+        return;
+    }
+
+    // Trie nodes stay behind; only the user's terminal marks go
+    const QStringList &keys = it.value().keys;
+    for (const QString &key : keys) {
+        quint32 node = findKey(key);
+        auto terminal = terminals.find(node);
+        if (terminal != terminals.end()) {
+            terminal.value().removeOne(user);
+            if (terminal.value().isEmpty()) {
+                terminals.erase(terminal);
+            }
+        }
+    }
+
+    // Then out of the completions along each key's path. A full list may
+    // have left someone out for this user, so it is recomputed from the
+    // subtree; renames are rare next to lookups.
+    QSet<quint32> refilled;
+    for (const QString &key : keys) {
+        quint32 node = 0;
+        for (int depth = 1; depth <= key.size(); ++depth) {
+            node = child(node, key.at(depth - 1).unicode());
+            if (node == 0) {
+                break;
+            }
+            QVector<Ranked> &list = top[int(node)];
+            for (int i = 0; i < list.size(); ++i) {
+                if (list[i].user != user) {
+                    continue;
+                }
+                if (list.size() == TOP_K) {
+                    if (!refilled.contains(node)) {
+                        refilled.insert(node);
+                        refill(node, depth);
+                    }
+                } else {
+                    list.removeAt(i);
+                }
+                break;
+            }
+        }
+    }
+    const QString &email = it.value().email;
+    for (int i = 0; i + 3 <= email.size(); ++i) {
+        auto gram = trigrams.find(trigramAt(email, i));
+        if (gram != trigrams.end()) {
+            gram.value().removeOne(user);
+            if (gram.value().isEmpty()) {
+                trigrams.erase(gram);
+            }
+        }
+    }
+    entries.erase(it);
+}
+
+QVector<UserHandle> UserDirectory::search(const QString &query, int limit) const {
+    QVector<UserHandle> result;
+    QString folded = query.simplified().toCaseFolded();
+    if (folded.isEmpty() || limit <= 0 || nodes.isEmpty()) {
+        return result;
+    }
+    QSet<UserHandle> seen;
+
+    // Prefix matches, shortest keys first: the query node's completions
+    // when they are enough, else breadth-first below it
+    quint32 start = findKey(folded);
+    if (start != 0 && limit <= TOP_K) {
+        for (const Ranked &ranked : top[int(start)]) {
+            seen.insert(ranked.user);
+            result.append(ranked.user);
+            if (result.size() >= limit) {
+                break;
+            }
+        }
+    } else if (start != 0) {
+        QVector<quint32> queue;
+        queue.append(start);
+        for (int head = 0; head < queue.size() && result.size() < limit; ++head) {
+            quint32 node = queue[head];
+            auto terminal = terminals.constFind(node);
+            if (terminal != terminals.constEnd()) {
+                for (UserHandle user : terminal.value()) {
+                    if (!seen.contains(user)) {
+                        seen.insert(user);
+                        result.append(user);
+                        if (result.size() >= limit) {
+                            break;
+                        }
+                    }
+                }
+            }
+            for (quint32 c = nodes[int(node)].firstChild; c != 0; c = nodes[int(c)].nextSibling) {
+                queue.append(c);
+            }
+        }
+    }
+
+    // Substring matches in emails: scan the rarest trigram's users and
+    // confirm each one, since sharing trigrams is not the same as containing
+    if (result.size() < limit && folded.size() >= 3) {
+        const QVector<UserHandle> *rarest = nullptr;
+        for (int i = 0; i + 3 <= folded.size(); ++i) {
+            auto gram = trigrams.constFind(trigramAt(folded, i));
+            if (gram == trigrams.constEnd()) {
+                return result; // Some trigram appears in no email
+            }
+            if (!rarest || gram.value().size() < rarest->size()) {
+                rarest = &gram.value();
+            }
+        }
+        for (UserHandle user : *rarest) {
+            if (seen.contains(user) || !entries.value(user).email.contains(folded)) {
+                continue;
+            }
+            seen.insert(user);
+            result.append(user);
+            if (result.size() >= limit) {
+                break;
+            }
+        }
+    }
+    return result;
+}
+
+qint64 UserDirectory::residentBytes() const {
+    qint64 bytes = sizeof(UserDirectory) + nodes.capacity() * qint64(sizeof(Node));
+    for (const QVector<Ranked> &list : top) {
+        bytes += sizeof(QVector<Ranked>) + list.capacity() * qint64(sizeof(Ranked));
+    }
+    for (const QVector<UserHandle> &users : terminals) {
+        bytes += sizeof(quint32) + sizeof(QVector<UserHandle>) + users.capacity() * qint64(sizeof(UserHandle));
+    }
+    for (const QVector<UserHandle> &users : trigrams) {
+        bytes += sizeof(quint64) + sizeof(QVector<UserHandle>) + users.capacity() * qint64(sizeof(UserHandle));
+    }
+    for (const Entry &entry : entries) {
+        bytes += sizeof(UserHandle) + sizeof(Entry) + entry.email.capacity() * qint64(sizeof(QChar));
+        for (const QString &key : entry.keys) {
+            bytes += sizeof(QString) + key.capacity() * qint64(sizeof(QChar));
+        }
+    }
+    return bytes;
+}
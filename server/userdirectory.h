@@ -0,0 +1,65 @@
+// userdirectory.h
+#ifndef USERDIRECTORY_H
+#define USERDIRECTORY_H
+
+#include <QHash>
+#include <QString>
+#include <QStringList>
+#include <QVector>
+#include <QtGlobal>
+#include "../client/userids.h"
+
+// Search index over the user directory. Case-folded nicknames (whole and by
+// word) and emails go into a prefix trie, so a query only walks the matching
+// branch. Every node also keeps its best TOP_K completions, filled as keys
+// are inserted, so a prefix lookup is O(|query| + limit) rather than a walk
+// of the subtree. Email trigrams also find matches in the middle of an
+// address.
+class UserDirectory {
+public:
+    static const int TOP_K = 64; // Per-node completions; larger limits walk the subtree
+
+    // Add a user or replace what is indexed for them
+    void put(UserHandle user, const QString &nickname, const QString &email);
+    void remove(UserHandle user);
+
+    // Users with a nickname word or email starting with query, shortest keys
+    // first, then users whose email contains it, up to limit
+    QVector<UserHandle> search(const QString &query, int limit) const;
+
+    int size() const { return entries.size(); }
+    qint64 residentBytes() const;
+
+private:
+    // Trie in one array. Children form a sibling chain; 0 means none, which
+    // is safe because the root (node 0) is never anyone's child.
+    struct Node {
+        quint32 firstChild = 0;
+        quint32 nextSibling = 0;
+        ushort ch = 0;
+    };
+    // One completion: a user and the length of their shortest key below a node
+    struct Ranked {
+        int length;
+        UserHandle user;
+    };
+    struct Entry {
+        QStringList keys; // Folded trie keys
+        QString email;    // Folded email, for trigram checks
+    };
+
+    QVector<Node> nodes;
+    QVector<QVector<Ranked>> top; // Per node: shortest keys first, then by handle
+    QHash<quint32, QVector<UserHandle>> terminals; // Node -> users whose key ends there
+    QHash<UserHandle, Entry> entries;
+    QHash<quint64, QVector<UserHandle>> trigrams;  // Three folded UTF-16 units -> users
+
+    quint32 child(quint32 node, ushort ch) const;
+    quint32 insertKey(const QString &key, UserHandle user);
+    void rank(quint32 node, UserHandle user, int length);
+    void refill(quint32 node, int depth); // Recompute a node's completions from its subtree
+    quint32 findKey(const QString &key) const;
+    static quint64 trigramAt(const QString &text, int index);
+};
+
+#endif // USERDIRECTORY_H
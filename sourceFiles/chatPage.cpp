@@ -37,9 +37,19 @@
 #include <QTimer>
 #include <QVBoxLayout>
 
+// Number of messages fetched per page when opening or scrolling a chat
+static const int MESSAGE_PAGE_SIZE = 50;
+
+// Most users a directory search brings into the list
+static const int USER_SEARCH_LIMIT = 50;
+
+// Users fetched per directory page while browsing
+static const int DIRECTORY_PAGE_SIZE = 50;
+
 ChatPage::ChatPage(QWidget *parent)
-    : QWidget(parent), currentUserId(-1), isSearching(false),
-      currentGroupId(-1), isInGroupChat(false) {
+    : QWidget(parent), currentUserId(-1), isSearching(false), browsingDirectory(false),
+      currentGroupId(-1), isInGroupChat(false), shownReadWatermark(0),
+      peerTyping(false), loadingOlderMessages(false) {
     QHBoxLayout *mainLayout = new QHBoxLayout(this);
     // hossam
 
@@ -155,7 +165,30 @@ ChatPage::ChatPage(QWidget *parent)
     onlineStatusTimer = new QTimer(this);
     connect(onlineStatusTimer, &QTimer::timeout, this,
             &ChatPage::refreshOnlineStatus);
-    onlineStatusTimer->start(3000); // 3 seconds instead of 10
+    onlineStatusTimer->start(server::PRESENCE_HEARTBEAT_MS); // Also our presence heartbeat
+
+    // Scrolling changes which rows are visible; send the new interest list
+    // once scrolling settles rather than on every step
+    presenceSubscriptionTimer = new QTimer(this);
+    presenceSubscriptionTimer->setSingleShot(true);
+    presenceSubscriptionTimer->setInterval(200);
+    connect(presenceSubscriptionTimer, &QTimer::timeout, this,
+            &ChatPage::updatePresenceSubscriptions);
+    connect(usersListWidget->verticalScrollBar(), &QScrollBar::valueChanged,
+            presenceSubscriptionTimer, [this]() { presenceSubscriptionTimer->start(); });
+
+    // While browsing the directory, reaching the bottom fetches the next page
+    connect(usersListWidget->verticalScrollBar(), &QScrollBar::valueChanged, this,
+            [this](int value) {
+                QScrollBar *bar = usersListWidget->verticalScrollBar();
+                if (!browsingDirectory || isSearching || directoryCursor.isEmpty() ||
+                    bar->maximum() == 0 || value < bar->maximum()) {
+                    return;
+                }
+                loadDirectoryPage();
+                updateUsersList();
+                bar->setValue(value);
+            });
 
     // Make sure profile avatar is properly initialized
     QTimer::singleShot(500, this, &ChatPage::updateProfileAvatar);
@@ -445,8 +478,14 @@ void ChatPage::createUsersPanel(QHBoxLayout *mainLayout) {
 
     usersLayout->addWidget(usersListWidget);
 
-    // Connect search and selection
-    connect(searchInput, &QLineEdit::textChanged, this, &ChatPage::filterUsers);
+    // Connect search and selection. The search runs once typing pauses
+    // rather than on every keystroke.
+    searchDebounceTimer = new QTimer(this);
+    searchDebounceTimer->setSingleShot(true);
+    searchDebounceTimer->setInterval(150);
+    connect(searchDebounceTimer, &QTimer::timeout, this, &ChatPage::filterUsers);
+    connect(searchInput, &QLineEdit::textChanged, searchDebounceTimer,
+            [this]() { searchDebounceTimer->start(); });
     connect(usersListWidget, &QListWidget::currentRowChanged, this,
             &ChatPage::handleUserSelected);
 
@@ -484,6 +523,15 @@ void ChatPage::createChatArea(QHBoxLayout *mainLayout) {
     chatLayout->addWidget(messageArea);
     chatLayout->setStretchFactor(messageArea, 1);
 
+    // Fetch the previous page of history once the user scrolls to the top
+    connect(messageArea->verticalScrollBar(), &QScrollBar::valueChanged, this,
+            [this](int value) {
+                if (value == messageArea->verticalScrollBar()->minimum() &&
+                    !isInGroupChat && currentUserId >= 0) {
+                    loadOlderMessages();
+                }
+            });
+
     // Input area
     QWidget *inputArea = new QWidget;
     QHBoxLayout *inputLayout = new QHBoxLayout(inputArea);
@@ -514,6 +562,21 @@ void ChatPage::createChatArea(QHBoxLayout *mainLayout) {
     connect(messageInput, &QLineEdit::returnPressed, this,
             &ChatPage::sendMessage);
 
+    // Tell the peer we are typing. The server throttles these, so every
+    // keystroke can go through; clearing the input (e.g. after sending)
+    // stops the indicator straight away.
+    connect(messageInput, &QLineEdit::textChanged, this,
+            [this](const QString &text) {
+                server *srv = server::getInstance();
+                Client *client = srv ? srv->getCurrentClient() : nullptr;
+                if (!client || isInGroupChat || currentUserId < 0 ||
+                    currentUserId >= userList.size()) {
+                    return;
+                }
+                srv->setTyping(client->getUserId(),
+                               userList[currentUserId].email, !text.isEmpty());
+            });
+
     messageInput->setMinimumHeight(40);
     sendButton->setMinimumHeight(40);
 
@@ -835,14 +898,7 @@ void ChatPage::logout() {
     // Get the current client before logging out
     Client *client = server::getInstance()->getCurrentClient();
     QString userId = client ? client->getUserId() : "";
-    bool wasOnline = false;
-
-    if (client) {
-        // Save the current status before logout
-        wasOnline = server::getInstance()->isUserOnline(userId);
-        qDebug() << "Before logout, user" << userId << "was"
-                 << (wasOnline ? "online" : "offline");
-    }
+    qDebug() << "Logging out user" << userId;
 
     // Stop the online status timer
     if (onlineStatusTimer) {
@@ -866,6 +922,7 @@ void ChatPage::logout() {
 
     // Clear user list
     usersListWidget->clear();
+    userRows.clear();
     userList.clear();
     userMessages.clear();
 
@@ -875,17 +932,10 @@ void ChatPage::logout() {
     // Reset current user
     currentUserId = -1;
 
-    // Log out the current user
+    // Log out the current user. Their "appear online" choice is kept by the
+    // server; presence itself ends with the session's heartbeats.
     server::getInstance()->logoutUser();
 
-    // If the user was online, put them back online
-    if (!userId.isEmpty() && wasOnline) {
-        // Restore the online status after logout
-        server::getInstance()->setUserOnlineStatus(userId, true);
-        qDebug() << "User" << userId
-                 << "status restored to online after logout";
-    }
-
     qDebug() << "Logging out and clearing UI";
 
     // Navigate back to login page (index 0)
@@ -941,37 +991,41 @@ void ChatPage::loadUsersFromDatabase() {
     chatHeader->setText("Select a user");
     messageInput->clear();
 
-    // Get all users from the server
-    QVector<QPair<QString, QString>> allUsers =
-        server::getInstance()->getAllUsers();
-    qDebug() << "Retrieved users from server:" << allUsers.size();
-
-    if (allUsers.isEmpty()) {
-        qDebug() << "WARNING: No users returned from getAllUsers()";
-    }
-
-    // Get all rooms to identify users with messages
-    QVector<Room *> allRooms = currentClient->getAllRooms();
-    QSet<QString> usersWithMessages;
-
-    // Identify users who have conversations
-    for (Room *room : allRooms) {
-        QStringList participants = room->getName().split('_');
-        for (const QString &participant : participants) {
-            if (participant != currentClient->getUserId() &&
-                !participant.isEmpty()) {
-                // Check if this room has any messages
-                if (!room->getMessagesAsVector().isEmpty()) {
-                    usersWithMessages.insert(participant);
-                    qDebug() << "User has messages:" << participant;
-                }
-            }
+    // The server keeps conversations ordered by last activity, so the
+    // sidebar takes that order as-is instead of sorting anything here
+    QVector<InboxEntry> recent = server::getInstance()->recentConversations(
+        currentClient->getUserId(), 0, -1);
+    QMap<QString, InboxEntry> conversations;
+    for (const InboxEntry &entry : recent) {
+        conversations[entry.peerId] = entry;
+    }
+    qDebug() << "Inbox has" << conversations.size() << "conversations";
+
+    // Only the people this user deals with are loaded: conversation peers
+    // and contacts. Everyone else comes in through search or directory
+    // pages, so login cost follows the user's own contacts, not the tenant.
+    QVector<QString> knownIds;
+    QSet<QString> seenIds;
+    for (const InboxEntry &entry : recent) {
+        if (!seenIds.contains(entry.peerId)) {
+            seenIds.insert(entry.peerId);
+            knownIds.append(entry.peerId);
         }
     }
+    for (const QString &contact : currentClient->getContacts()) {
+        if (!seenIds.contains(contact)) {
+            seenIds.insert(contact);
+            knownIds.append(contact);
+        }
+    }
+    QVector<QPair<QString, QString>> knownUsers =
+        server::getInstance()->lookupUsers(knownIds);
+    qDebug() << "Retrieved users from server:" << knownUsers.size();
 
     QVector<UserInfo>
         usersWithMessagesVec; // To store users with messages (will be pinned)
     QVector<UserInfo> regularUsers; // To store users without messages
+    QMap<QString, UserInfo> pinnedByEmail; // Users with messages, placed in activity order below
 
     // Get server instance for online status
     server *srv = server::getInstance();
@@ -984,8 +1038,8 @@ void ChatPage::loadUsersFromDatabase() {
         blockedUsersSet.insert(blocked);
     }
 
-    // Add all users to the list except current user and blocked users
-    for (const auto &user : allUsers) {
+    // Add everyone we know except the current user and blocked users
+    for (const auto &user : knownUsers) {
         QString email = user.first;     // This is the email (userId)
         QString nickname = user.second; // This is the nickname, not username
 
@@ -1012,20 +1066,17 @@ void ChatPage::loadUsersFromDatabase() {
         userInfo.isContact = currentClient->hasContact(email);
         
         // Check if we have messages with this user
-        userInfo.hasMessages = false;
-        for (Room *room : allRooms) {
-            QString roomId = room->getRoomId();
-            if (roomId.contains(email) && !room->getMessagesAsVector().isEmpty()) {
-                userInfo.hasMessages = true;
-                usersWithMessages.insert(email);
-                qDebug() << "User has messages - Room ID:" << roomId;
-                break;
-            }
+        auto conversation = conversations.constFind(email);
+        userInfo.hasMessages = conversation != conversations.constEnd();
+        if (userInfo.hasMessages) {
+            userInfo.lastMessage = conversation.value().lastMessage;
+            userInfo.lastSeen =
+                conversation.value().lastActivity.toString("hh:mm");
         }
 
         // Add to the appropriate list
         if (userInfo.hasMessages) {
-            usersWithMessagesVec.append(userInfo);
+            pinnedByEmail.insert(email, userInfo);
             qDebug() << "Added user with messages:" << nickname << "(" << email << ")";
         } else {
             regularUsers.append(userInfo);
@@ -1033,8 +1084,24 @@ void ChatPage::loadUsersFromDatabase() {
         }
     }
 
+    // Pinned users follow the server's most-recent-first order
+    for (const InboxEntry &entry : recent) {
+        auto pinned = pinnedByEmail.constFind(entry.peerId);
+        if (pinned != pinnedByEmail.constEnd()) {
+            usersWithMessagesVec.append(pinned.value());
+        }
+    }
+
     // Combine the lists - users with messages first, then regular users
     userList = usersWithMessagesVec + regularUsers;
+
+    // Nobody to show yet (e.g. a new account): offer the directory instead,
+    // a page at a time as the list is scrolled
+    directoryCursor.clear();
+    browsingDirectory = userList.isEmpty();
+    if (browsingDirectory) {
+        loadDirectoryPage();
+    }
     if (currentUserId < 0 || currentUserId >= userList.size())
         chatHeader->setText("Select a user");
     else
@@ -1052,6 +1119,7 @@ void ChatPage::loadUsersFromDatabase() {
 
     // IMPORTANT: Clear the list widget BEFORE adding new items
     usersListWidget->clear();
+    userRows.clear();
 
     // Update the UI with the loaded users - this populates the user list widget
     updateUsersList();
@@ -1073,6 +1141,7 @@ void ChatPage::updateUsersList() {
 
     // Clear the list first
     usersListWidget->clear();
+    userRows.clear();
 
     // Get the current client and server instance
     Client *currentClient = server::getInstance()->getCurrentClient();
@@ -1100,8 +1169,8 @@ void ChatPage::updateUsersList() {
             continue;
         }
 
-        // Update online status for each user
-        userList[i].isOnline = srv->isUserOnline(userList[i].email);
+        // Online status is kept current by refreshOnlineStatus(), which
+        // drains the presence updates we subscribed to
         userList[i].status = userList[i].isOnline ? "Online" : "Offline";
 
         // Update nickname and bio if available
@@ -1166,22 +1235,13 @@ void ChatPage::updateUsersList() {
         const UserInfo &user = userList[i];
 
         // Determine if this user should be shown
-        bool showUser = false;
-
-        // When searching, show only matches
-        if (isSearching) {
-            showUser = user.name.toLower().contains(searchText) ||
-                       user.email.toLower().contains(searchText);
-        }
-        // Otherwise show contacts and users with messages
-        else {
-            showUser = user.isContact || user.hasMessages;
-        }
+        bool showUser = userRowVisible(user);
 
         // If we should show this user, add to the list
         if (showUser) {
             QListWidgetItem *item = createUserListItem(user, i);
             usersListWidget->addItem(item);
+            userRows.insert(user.email, item);
 
             // Properly set the item widget
             QWidget *widget = item->data(Qt::UserRole + 1).value<QWidget *>();
@@ -1196,12 +1256,14 @@ void ChatPage::updateUsersList() {
     qDebug() << "Added " << countAdded << " items to the list widget";
 
     // If we didn't add any users but have users in our list, add them all
-    if (countAdded == 0 && !userList.isEmpty()) {
+    // (a search with no matches shows an empty list instead)
+    if (countAdded == 0 && !userList.isEmpty() && !isSearching) {
         qDebug() << "No users matched filter criteria, showing all users";
 
         for (int i = 0; i < userList.size(); ++i) {
             QListWidgetItem *item = createUserListItem(userList[i], i);
             usersListWidget->addItem(item);
+            userRows.insert(userList[i].email, item);
 
             QWidget *widget = item->data(Qt::UserRole + 1).value<QWidget *>();
             if (widget) {
@@ -1212,11 +1274,184 @@ void ChatPage::updateUsersList() {
 
     // Re-enable signals
     usersListWidget->blockSignals(false);
+
+    // The set of rows changed, so our presence interests may have too
+    updatePresenceSubscriptions();
+}
+
+void ChatPage::updatePresenceSubscriptions() {
+    server *srv = server::getInstance();
+    Client *currentClient = srv ? srv->getCurrentClient() : nullptr;
+    if (!currentClient) {
+        return;
+    }
+
+    // Contacts and the open chat are always watched
+    QVector<QString> interests = currentClient->getContacts();
+    if (currentUserId >= 0 && currentUserId < userList.size()) {
+        interests.append(userList[currentUserId].email);
+    }
+
+    // Plus whatever user rows are on screen right now: only the rows
+    // between the viewport's top and bottom edges are looked at
+    int count = usersListWidget->count();
+    if (count > 0) {
+        QRect viewport = usersListWidget->viewport()->rect();
+        QModelIndex top = usersListWidget->indexAt(viewport.topLeft());
+        QModelIndex bottom = usersListWidget->indexAt(viewport.bottomLeft());
+        int first = top.isValid() ? top.row() : 0;
+        int last = bottom.isValid() ? bottom.row() : count - 1; // List ends above the bottom
+        for (int row = first; row <= last; ++row) {
+            QListWidgetItem *item = usersListWidget->item(row);
+            if (!item || item->isHidden() || !(item->flags() & Qt::ItemIsEnabled) ||
+                item->data(Qt::UserRole + 2).toBool()) {
+                continue; // Separator, group or filtered-out row
+            }
+            int index = item->data(Qt::UserRole).toInt();
+            if (index >= 0 && index < userList.size()) {
+                interests.append(userList[index].email);
+            }
+        }
+    }
+
+    // The server only applies the difference; newly watched users come back
+    // through the next drain in refreshOnlineStatus()
+    srv->setPresenceInterests(currentClient->getUserId(), interests);
 }
 
 void ChatPage::filterUsers() {
+    bool wasSearching = isSearching;
+    QSet<QString> previousMatches = searchMatches;
     isSearching = !searchInput->text().isEmpty();
-    updateUsersList();
+
+    // Ask the server's directory index instead of scanning every user here.
+    // Matches we have not loaded yet are added to the list on the spot.
+    searchMatches.clear();
+    QHash<QString, int> matchIndexes;
+    if (isSearching) {
+        const QVector<QPair<QString, QString>> matches =
+            server::getInstance()->searchUsers(searchInput->text(), USER_SEARCH_LIMIT);
+        for (const auto &match : matches) {
+            int index = addDirectoryUser(match.first, match.second);
+            if (index >= 0) {
+                searchMatches.insert(match.first);
+                matchIndexes.insert(match.first, index);
+            }
+        }
+    }
+    applySearchFilter(wasSearching, previousMatches, matchIndexes);
+}
+
+bool ChatPage::userRowVisible(const UserInfo &user) const {
+    // When searching, show only what the directory search matched;
+    // otherwise contacts, chats, or the directory when there are neither
+    if (isSearching) {
+        return searchMatches.contains(user.email);
+    }
+    return user.isContact || user.hasMessages || browsingDirectory;
+}
+
+void ChatPage::applySearchFilter(bool wasSearching, const QSet<QString> &previousMatches,
+                                 const QHash<QString, int> &matchIndexes) {
+    usersListWidget->setUpdatesEnabled(false);
+    usersListWidget->blockSignals(true);
+
+    // Group rows sit at the top of the list and are few
+    QString searchText = searchInput->text().toLower();
+    for (int row = 0; row < usersListWidget->count(); ++row) {
+        QListWidgetItem *item = usersListWidget->item(row);
+        if (!item->data(Qt::UserRole + 2).toBool()) {
+            break;
+        }
+        int index = item->data(Qt::UserRole).toInt();
+        bool show = !isSearching || (index >= 0 && index < groupList.size() &&
+                                     groupList[index].name.toLower().contains(searchText));
+        item->setHidden(!show);
+    }
+
+    // Within a search only the matches that came or went can change; entering
+    // or leaving search mode flips every row's rule, so all rows are checked
+    QSet<QString> candidates;
+    if (wasSearching && isSearching) {
+        candidates = previousMatches;
+        candidates.unite(searchMatches);
+    } else {
+        for (auto it = userRows.constBegin(); it != userRows.constEnd(); ++it) {
+            candidates.insert(it.key());
+        }
+        candidates.unite(searchMatches);
+    }
+
+    int shown = 0;
+    for (const QString &email : candidates) {
+        QListWidgetItem *item = userRows.value(email, nullptr);
+        int index = item ? item->data(Qt::UserRole).toInt() : matchIndexes.value(email, -1);
+        bool show = index >= 0 && index < userList.size() && userRowVisible(userList[index]);
+        if (item) {
+            if (item->isHidden() == show) {
+                item->setHidden(!show);
+            }
+        } else if (show) {
+            // A match that has no row yet
+            item = createUserListItem(userList[index], index);
+            usersListWidget->addItem(item);
+            QWidget *widget = item->data(Qt::UserRole + 1).value<QWidget *>();
+            if (widget) {
+                usersListWidget->setItemWidget(item, widget);
+            }
+            userRows.insert(email, item);
+        }
+        shown += show ? 1 : 0;
+    }
+
+    usersListWidget->blockSignals(false);
+    usersListWidget->setUpdatesEnabled(true);
+
+    // Back out of a search with nothing to show: the full rebuild falls
+    // back to listing everyone
+    if (!isSearching && wasSearching && shown == 0 && !userList.isEmpty()) {
+        updateUsersList();
+        return;
+    }
+    updatePresenceSubscriptions();
+}
+
+int ChatPage::addDirectoryUser(const QString &email, const QString &nickname) {
+    server *srv = server::getInstance();
+    Client *currentClient = srv->getCurrentClient();
+    if (!currentClient || email == currentClient->getUserId() ||
+        srv->isUserBlocked(currentClient->getUserId(), email)) {
+        return -1;
+    }
+
+    for (int i = 0; i < userList.size(); ++i) {
+        if (userList[i].email == email) {
+            return i;
+        }
+    }
+
+    UserInfo userInfo;
+    userInfo.name = nickname;
+    userInfo.email = email;
+    userInfo.isOnline = srv->isUserOnline(email);
+    userInfo.status = userInfo.isOnline ? "Online" : "Offline";
+    userInfo.isContact = currentClient->hasContact(email);
+    userInfo.hasMessages = false;
+    userList.append(userInfo);
+    userMessages.resize(userList.size());
+    return userList.size() - 1;
+}
+
+void ChatPage::loadDirectoryPage() {
+    QString nextCursor;
+    const QVector<QPair<QString, QString>> page = server::getInstance()->listUsers(
+        directoryCursor, DIRECTORY_PAGE_SIZE, &nextCursor);
+    for (const auto &user : page) {
+        addDirectoryUser(user.first, user.second);
+    }
+    directoryCursor = nextCursor;
+    qDebug() << "Loaded directory page of" << page.size() << "users;"
+             << (nextCursor.isEmpty() ? "no more pages" : "more to come");
 }
 
 void ChatPage::handleUserSelected(int row) {
@@ -1288,6 +1523,7 @@ void ChatPage::updateChatArea(int index) {
 
     // Update header with latest info
     const UserInfo &user = userList[index];
+    peerTyping = false; // The header below shows status, not typing
 
     // Always get the most current user info from server
     server *srv = server::getInstance();
@@ -1334,11 +1570,19 @@ void ChatPage::updateChatArea(int index) {
     currentUserId = index;
     loadMessagesForCurrentUser();
 
+    // Bubbles are created with the recipient's current watermark applied
+    shownReadWatermark = 0;
+    if (Client *client = server::getInstance()->getCurrentClient()) {
+        QString roomId = Room::generateRoomId(client->getUserId(), user.email);
+        shownReadWatermark =
+            server::getInstance()->getReadWatermark(roomId, user.email);
+    }
+
     // Add messages to UI
     if (index < userMessages.size()) {
         const QVector<MessageInfo> &messages = userMessages[index];
         for (const MessageInfo &msg : messages) {
-            addMessageToUI(msg.text, msg.isFromMe, msg.timestamp);
+            addMessageToUI(msg.text, msg.isFromMe, msg.timestamp, msg.seq);
         }
     }
 
@@ -1452,118 +1696,46 @@ void ChatPage::sendMessage() {
         }
 
         const UserInfo &user = userList[currentUserId];
+        QString targetId = user.email.isEmpty() ? user.name : user.email;
+
+        // Validation, the room, persistence, indexing and the recipient's
+        // side (contact, room, read mark) all happen in the server's post
+        // pipeline
+        server *srv = server::getInstance();
+        PostResult posted = srv->postMessage(senderId, targetId, messageText);
+        if (!posted.ok()) {
+            qDebug() << "Message to" << targetId << "not sent - status" << posted.status;
+            if (posted.status == PostResult::Blocked) {
+                QMessageBox::information(this, "Message Not Sent",
+                                         "You can't send messages to this user.");
+            }
+            return;
+        }
+        userList[currentUserId].isContact = true; // The pipeline added them
 
         // Add message to ChatPage data structures
         MessageInfo msgInfo;
         msgInfo.text = messageText;
         msgInfo.isFromMe = true;
         msgInfo.timestamp = QDateTime::currentDateTime();
-        
+        msgInfo.seq = posted.seq;
+
         // Add to user messages
         if (currentUserId >= userMessages.size()) {
             userMessages.resize(currentUserId + 1);
         }
         userMessages[currentUserId].append(msgInfo);
 
-        // Add message to Room data structure (which will persist to disk)
-        QString targetId = user.email.isEmpty() ? user.name : user.email;
-        
-        // Automatically mark the message as read if recipient is online
-        bool recipientOnline = server::getInstance()->isUserOnline(targetId);
-        
-        // Create the message - notice we don't need to manually set read status here
-        // as it's false by default unless recipient is online
-        Message msg(messageText, senderId);
-        
-        // Set read status based on recipient's online status
-        if (recipientOnline) {
-            msg.markAsRead();
-            qDebug() << "Message automatically marked as read since recipient is online:" << targetId;
-        }
-
-        // Attempt to get or create the room with proper diagnostics
-        qDebug() << "Attempting to find room with user:" << targetId;
-        Room *room = client->getRoomWithUser(targetId);
-        
-        if (!room) {
-            qDebug() << "No existing room found, creating new room with user:" << targetId;
-            room = client->createRoom(targetId);
-            
-            if (!userList[currentUserId].isContact) {
-                userList[currentUserId].isContact = true;
-                client->addContact(targetId);
-                qDebug() << "Added user to contacts:" << targetId;
-            }
-        }
-
-        // Add the message to the file and in-memory structure
-        room->addMessage(msg);
-
-        // Save messages to disk immediately
-        room->saveMessages();
-        qDebug() << "Saved message to disk for room:" << room->getRoomId();
-
-        // Make sure the message is also added to the server's in-memory
-        // structure
-        server *srv = server::getInstance();
-        QVector<Message> roomMsgs = room->getMessagesAsVector();
-        srv->updateRoomMessages(room->getRoomId(), roomMsgs);
-
-        // Check if the target user is logged in
-        if (srv->hasClient(targetId)) {
-            Client *targetClient = srv->getClient(targetId);
-            // If the target user is logged in, check if they need to be added as a contact
-            if (!srv->hasContactForUser(targetId, senderId)) {
-            srv->addContactForUser(targetId, senderId);
-                qDebug() << "Added" << senderId << "as contact for user" << targetId;
-            }
-
-            // Check if the room needs to be created for the recipient
-            if (!srv->hasRoomForUser(targetId, room->getRoomId())) {
-                Room *recipientRoom = new Room(room->getName());
-                recipientRoom->setRoomId(room->getRoomId());
-                recipientRoom->setMessages(roomMsgs);
-                srv->addRoomToUser(targetId, recipientRoom);
-                qDebug() << "Added room to user" << targetId;
-        } else {
-            // The target user is logged in, so update their Client object
-            Client *targetClient = srv->getClient(targetId);
-            if (targetClient) {
-                // Add contact if needed
-                if (!targetClient->hasContact(senderId)) {
-                    targetClient->addContact(senderId);
-                    qDebug() << "Added" << senderId
-                             << "as contact for logged in user" << targetId;
-                }
-
-                // Update their room with the new message
-                    Room *recipientRoom = targetClient->getRoom(room->getRoomId());
-                if (!recipientRoom) {
-                    // Create new room for recipient if it doesn't exist
-                    recipientRoom = new Room(room->getName());
-                    recipientRoom->setMessages(roomMsgs);
-                    targetClient->addRoom(recipientRoom);
-                    qDebug() << "Added room to logged in user" << targetId;
-                } else {
-                    // Update existing room
-                    recipientRoom->setMessages(roomMsgs);
-                    qDebug() << "Updated room for logged in user" << targetId;
-                    }
-                }
-            }
-        }
-
         // Update the last message and UI
         userList[currentUserId].lastMessage = messageText;
         userList[currentUserId].lastSeen = "Just now";
         userList[currentUserId].hasMessages =
             true; // Mark user as having messages
 
-        // If the users list needs reordering (if this wasn't already a pinned
-        // user)
-        if (!userList[currentUserId].hasMessages) {
-            // Reorder the user list to put this user at the top (since they now
-            // have messages)
+        // This conversation is now the most recent one, which is where the
+        // server's activity index puts it too
+        if (currentUserId > 0) {
+            // Reorder the user list to put this user at the top
             UserInfo userInfo = userList[currentUserId];
             userList.removeAt(currentUserId);
             userList.prepend(userInfo);
@@ -1615,7 +1787,7 @@ void ChatPage::displayLatestMessage(int userIndex) {
     }
     
     // Using stack's top() method to get the most recent message without traversing all messages
-    if (!room->getMessages().isEmpty()) {
+    if (!room->isEmpty()) {
         Message latestMsg = room->getLatestMessage();
         
         QDateTime timestamp = latestMsg.getTimestamp();
@@ -1639,7 +1811,8 @@ void ChatPage::displayLatestMessage(int userIndex) {
 }
 
 void ChatPage::addMessageToUI(const QString &text, bool isFromMe,
-                              const QDateTime &timestamp) {
+                              const QDateTime &timestamp, quint64 seq,
+                              bool prepend) {
     QWidget *bubbleRow = new QWidget();
     QHBoxLayout *rowLayout = new QHBoxLayout(bubbleRow);
     rowLayout->setContentsMargins(
@@ -1664,24 +1837,13 @@ void ChatPage::addMessageToUI(const QString &text, bool isFromMe,
     bool isRead = false;
     
     if (isFromMe && currentUserId >= 0) {
-        // Find the message in the room to check its read status
+        // Read if the recipient's watermark has reached this message
         Client *client = server::getInstance()->getCurrentClient();
         if (client) {
             QString senderId = client->getUserId();
             QString recipientId = userList[currentUserId].email;
             QString roomId = Room::generateRoomId(senderId, recipientId);
-            Room *room = client->getRoom(roomId);
-            
-            if (room) {
-                // Find this message based on timestamp to get its read status
-                QList<Message> messages = room->getMessages();
-                for (const Message &msg : messages) {
-                    if (msg.getTimestamp() == timestamp && msg.getSender() == senderId) {
-                        isRead = msg.getReadStatus();
-                        break;
-                    }
-                }
-            }
+            isRead = server::getInstance()->isMessageRead(roomId, recipientId, seq);
         }
         
         // Create the read receipt checkmarks
@@ -1742,6 +1904,7 @@ void ChatPage::addMessageToUI(const QString &text, bool isFromMe,
     bubbleContent->setProperty("isFromMe", isFromMe);
     bubbleContent->setProperty("messageText", text);
     bubbleContent->setProperty("timestamp", timestamp);
+    bubbleContent->setProperty("seq", seq);
     bubbleContent->setProperty("isRead", isRead);
     bubbleContent->installEventFilter(this);
 
@@ -1754,8 +1917,12 @@ void ChatPage::addMessageToUI(const QString &text, bool isFromMe,
         rowLayout->addStretch();
     }
 
-    // Add to layout
-    messageLayout->insertWidget(messageLayout->count() - 1, bubbleRow);
+    // Add to layout (older pages go above everything already shown)
+    if (prepend) {
+        messageLayout->insertWidget(0, bubbleRow);
+    } else {
+        messageLayout->insertWidget(messageLayout->count() - 1, bubbleRow);
+    }
 }
 
 bool ChatPage::eventFilter(QObject *obj, QEvent *event) {
@@ -1839,12 +2006,10 @@ void ChatPage::showMessageOptions(QWidget *bubble) {
 
                 // Update in data structure
                 if (currentUserId >= 0) {
-                    QDateTime timestamp =
-                        bubble->property("timestamp").toDateTime();
+                    quint64 seq = bubble->property("seq").toULongLong();
                     for (int i = 0; i < userMessages[currentUserId].size();
                          i++) {
-                        if (userMessages[currentUserId][i].timestamp ==
-                            timestamp) {
+                        if (userMessages[currentUserId][i].seq == seq) {
                             userMessages[currentUserId][i].text = newText;
                             break;
                         }
@@ -1852,8 +2017,7 @@ void ChatPage::showMessageOptions(QWidget *bubble) {
 
                     // Update last message if needed
                     if (!userMessages[currentUserId].isEmpty() &&
-                        userMessages[currentUserId].last().timestamp ==
-                            timestamp) {
+                        userMessages[currentUserId].last().seq == seq) {
                         userList[currentUserId].lastMessage = newText;
                         updateUsersList();
                     }
@@ -1867,33 +2031,9 @@ void ChatPage::showMessageOptions(QWidget *bubble) {
                                 : userList[currentUserId].email;
                         Room *room = client->getRoomWithUser(targetId);
                         if (room) {
-                            // Update the message in the room
-                            QVector<Message> messages = room->getMessagesAsVector();
-                            for (int j = 0; j < messages.size(); j++) {
-                                if (messages[j].getTimestamp() == timestamp) {
-                                    // We can't modify the message directly, so
-                                    // remove and add a new one
-                                    room->removeMessage(j);
-                                    Message newMsg(newText,
-                                                   client->getUserId());
-                                    room->addMessage(newMsg);
-                                    break;
-                                }
-                            }
-                            // Save changes to disk
-                            room->saveMessages();
-
-                            // Update the server's in-memory message structure
-                            // for both users
-                            server *srv = server::getInstance();
-                            QString roomId = room->getRoomId();
-                            QVector<Message> updatedMsgs = room->getMessagesAsVector();
-
-                            // Update messages in server
-                            srv->updateRoomMessages(roomId, updatedMsgs);
-
-                            qDebug() << "Saved edited message to disk for room:"
-                                     << room->getRoomId();
+                            // The server edits the shared log in place, saves
+                            // it and keeps search and the inbox previews in step
+                            server::getInstance()->editMessage(room->getRoomId(), seq, newText);
                         }
                     }
                 }
@@ -2268,31 +2408,28 @@ void ChatPage::loadMessagesForCurrentUser() {
     // Clear existing messages to prevent duplication
     userMessages[currentUserId].clear();
 
-    // Load messages from the room
+    // Load the newest page of messages from the room
     room->loadMessages();
-    const QVector<Message> &roomMessages = room->getMessagesAsVector();
-    qDebug() << "Room has" << roomMessages.size() << "messages";
-
-    // Add messages to userMessages, avoiding duplicates
+    const QVector<Message> roomMessages =
+        room->getMessagesBefore(0, MESSAGE_PAGE_SIZE);
+    qDebug() << "Room is at seq" << room->getLastSeq() << "- showing"
+             << roomMessages.size() << "messages";
+
+    // Messages arrive sorted by sequence number, so a duplicate can only
+    // repeat the last one we kept
+    quint64 lastSeq = 0;
     for (const Message &msg : roomMessages) {
+        if (msg.getSeq() <= lastSeq) {
+            continue;
+        }
+        lastSeq = msg.getSeq();
+
         MessageInfo msgInfo;
         msgInfo.text = msg.getContent();
         msgInfo.isFromMe = (msg.getSender() == client->getUserId());
         msgInfo.timestamp = msg.getTimestamp();
-
-        // Check for duplicates before adding
-        bool isDuplicate = false;
-        for (const MessageInfo &existingMsg : userMessages[currentUserId]) {
-            if (existingMsg.text == msgInfo.text &&
-                existingMsg.timestamp == msgInfo.timestamp &&
-                existingMsg.isFromMe == msgInfo.isFromMe) {
-                isDuplicate = true;
-                break;
-            }
-        }
-        if (!isDuplicate) {
-            userMessages[currentUserId].append(msgInfo);
-        }
+        msgInfo.seq = msg.getSeq();
+        userMessages[currentUserId].append(msgInfo);
     }
 
     qDebug() << "Loaded" << userMessages[currentUserId].size()
@@ -2647,15 +2784,26 @@ void ChatPage::refreshOnlineStatus() {
         return;
     }
 
+    // This timer doubles as our presence heartbeat; it also lets the server
+    // expire anyone whose heartbeats have stopped
+    srv->heartbeat(srv->getCurrentClient()->getUserId());
+    srv->tickPresence();
+
     // CRITICAL FIX: Force updates every 3 seconds to catch all changes
     bool needsUiUpdate = true;  // Force update every time
     bool statusChanged = false; // Track if any status has changed
 
-    // Check online status and bio for all users in the list
-    for (int i = 0; i < userList.size(); ++i) {
-        // Always check online status - this ensures we pick up changes from
-        // other clients
-        bool isOnline = srv->isUserOnline(userList[i].email);
+    // Only users we subscribed to (contacts, visible rows) report changes,
+    // so there is no need to ask about everyone in the list
+    QHash<QString, bool> updates =
+        srv->takePresenceUpdates(srv->getCurrentClient()->getUserId());
+    for (int i = 0; i < userList.size() && !updates.isEmpty(); ++i) {
+        auto update = updates.find(userList[i].email);
+        if (update == updates.end()) {
+            continue;
+        }
+        bool isOnline = update.value();
+        updates.erase(update);
         bool onlineChanged = (userList[i].isOnline != isOnline);
 
         if (onlineChanged) {
@@ -2689,6 +2837,27 @@ void ChatPage::refreshOnlineStatus() {
         }
     }
 
+    // Show the open chat's peer as typing while their indicator lasts
+    if (!isInGroupChat && currentUserId >= 0 && currentUserId < userList.size()) {
+        const UserInfo &peer = userList[currentUserId];
+        bool typing = srv->isUserTyping(peer.email,
+                                        srv->getCurrentClient()->getUserId());
+        if (typing != peerTyping) {
+            peerTyping = typing;
+            if (typing) {
+                chatHeader->setText(peer.name + " - typing...");
+            } else {
+                QString nickname, bio;
+                srv->getUserSettings(peer.email, nickname, bio);
+                QString headerText = peer.name + " - " + peer.status;
+                if (!bio.isEmpty()) {
+                    headerText += " (" + bio + ")";
+                }
+                chatHeader->setText(headerText);
+            }
+        }
+    }
+
     // Print diagnostic message if status changed
     if (statusChanged) {
         qDebug() << "Online status changes detected - updating UI";
@@ -5030,7 +5199,7 @@ void ChatPage::addGroupMessageToUI(const QString &text, const QString &senderId,
         rowLayout->addStretch();
     }
 
-    // Add to layout
+    // Add to layout (group history is not paged, so always append)
     messageLayout->insertWidget(messageLayout->count() - 1, bubbleRow);
 }
 
@@ -5045,37 +5214,14 @@ void ChatPage::markMessagesAsRead(int userIndex) {
         return;
     }
 
-    QString senderId = client->getUserId();
-    QString recipientId = userList[userIndex].email;
-    QString roomId = Room::generateRoomId(senderId, recipientId);
-    Room *room = client->getRoom(roomId);
-            
-    if (room) {
-        bool messagesMarkedAsRead = false;
-        
-        // Get all messages and mark unread ones from the other user as read
-        QList<Message> messages = room->getMessages();
-        QList<Message> updatedMessages;
-        
-        for (Message msg : messages) {
-            // If this message is from the other user and not read yet
-            if (msg.getSender() == recipientId && !msg.getReadStatus()) {
-                msg.markAsRead();
-                messagesMarkedAsRead = true;
-            }
-            updatedMessages.append(msg);
-        }
-        
-        if (messagesMarkedAsRead) {
-            // Update the room with the modified messages
-            room->setMessages(updatedMessages);
-            
-            // Save the changes to the server and persist
-            server::getInstance()->setMessageListFromVector(roomId, room->getMessagesAsVector());
-            room->saveMessages();
-            
-            qDebug() << "Marked messages as read in room:" << roomId;
-        }
+    QString readerId = client->getUserId();
+    QString otherId = userList[userIndex].email;
+    QString roomId = Room::generateRoomId(readerId, otherId);
+
+    // Everything in the room up to its newest message is now read
+    if (server::getInstance()->markRoomRead(
+            roomId, readerId, server::getInstance()->getRoomLastSeq(roomId))) {
+        qDebug() << "Marked messages as read in room:" << roomId;
     }
 }
 
@@ -5093,9 +5239,11 @@ void ChatPage::updateReadReceipts() {
     QString senderId = client->getUserId();
     QString recipientId = userList[currentUserId].email;
     QString roomId = Room::generateRoomId(senderId, recipientId);
-    Room *room = client->getRoom(roomId);
-    
-    if (!room) {
+
+    // Nothing to do unless the recipient has read further since last time
+    quint64 watermark =
+        server::getInstance()->getReadWatermark(roomId, recipientId);
+    if (watermark <= shownReadWatermark) {
         return;
     }
     
@@ -5110,40 +5258,104 @@ void ChatPage::updateReadReceipts() {
         QList<QWidget*> bubbles = bubbleRow->findChildren<QWidget*>(QString(), Qt::FindDirectChildrenOnly);
         
         for (QWidget *bubble : bubbles) {
-            // Check if this is a sent message
-            if (bubble->property("isFromMe").toBool()) {
-                QDateTime timestamp = bubble->property("timestamp").toDateTime();
-                bool currentReadStatus = bubble->property("isRead").toBool();
-                
-                // Find this message in the room to check its current read status
-                QList<Message> messages = room->getMessages();
-                for (const Message &msg : messages) {
-                    if (msg.getTimestamp() == timestamp && msg.getSender() == senderId) {
-                        // If read status has changed, update the UI
-                        if (msg.getReadStatus() != currentReadStatus) {
-                            // Find the read receipt label
-                            QList<QLabel*> labels = bubble->findChildren<QLabel*>();
-                            for (QLabel *label : labels) {
-                                if (label->text() == "✓✓") {
-                                    // Update read receipt appearance
-                                    if (msg.getReadStatus()) {
-                                        label->setStyleSheet("font-size: 12px; color: #4169E1;"); // Blue for read
-                                    } else {
-                                        label->setStyleSheet("font-size: 12px; color: #A0A0A0;"); // Gray for delivered
-                                    }
-                                    break;
-                                }
-                            }
-                            
-                            // Update the property
-                            bubble->setProperty("isRead", msg.getReadStatus());
-                        }
-                        break;
-                    }
+            // Only sent messages that just crossed the watermark change state
+            if (!bubble->property("isFromMe").toBool() ||
+                bubble->property("isRead").toBool()) {
+                continue;
+            }
+
+            quint64 seq = bubble->property("seq").toULongLong();
+            if (seq == 0 || seq > watermark) {
+                continue;
+            }
+
+            // Find the read receipt label
+            QList<QLabel*> labels = bubble->findChildren<QLabel*>();
+            for (QLabel *label : labels) {
+                if (label->text() == "✓✓") {
+                    label->setStyleSheet("font-size: 12px; color: #4169E1;"); // Blue for read
+                    break;
                 }
             }
+            
+            // Update the property
+            bubble->setProperty("isRead", true);
         }
     }
+
+    shownReadWatermark = watermark;
+}
+
+// Prepend the page of messages just before the oldest one on screen
+UiTask ChatPage::loadOlderMessages() {
+    if (loadingOlderMessages || currentUserId < 0 || currentUserId >= userList.size() ||
+        currentUserId >= userMessages.size() ||
+        userMessages[currentUserId].isEmpty()) {
+        co_return;
+    }
+
+    Client *client = server::getInstance()->getCurrentClient();
+    if (!client) {
+        co_return;
+    }
+
+    Room *room = client->getRoomWithUser(userList[currentUserId].email);
+    if (!room) {
+        co_return;
+    }
+
+    quint64 oldestSeq = userMessages[currentUserId].first().seq;
+    if (oldestSeq <= 1) {
+        co_return; // Already showing the start of the conversation
+    }
+
+    // The page is read on the server's executor; we resume here afterwards
+    const int userIndex = currentUserId;
+    loadingOlderMessages = true;
+    QVector<Message> olderMessages =
+        co_await server::getInstance()
+            ->loadRoomPage(room->getRoomId(), oldestSeq, MESSAGE_PAGE_SIZE)
+            .resumeOn(this);
+    loadingOlderMessages = false;
+
+    // The user may have switched chats while the page was loading
+    if (olderMessages.isEmpty() || isInGroupChat || currentUserId != userIndex ||
+        userIndex >= userMessages.size() || userMessages[userIndex].isEmpty() ||
+        userMessages[userIndex].first().seq != oldestSeq) {
+        co_return;
+    }
+    client = server::getInstance()->getCurrentClient();
+    if (!client) {
+        co_return;
+    }
+
+    QScrollBar *vScrollBar = messageArea->verticalScrollBar();
+    int distanceFromBottom = vScrollBar->maximum() - vScrollBar->value();
+
+    // Walk newest to oldest so each bubble lands above the previous one
+    QVector<MessageInfo> page;
+    page.reserve(olderMessages.size());
+    for (int i = olderMessages.size() - 1; i >= 0; --i) {
+        const Message &msg = olderMessages[i];
+        MessageInfo msgInfo;
+        msgInfo.text = msg.getContent();
+        msgInfo.isFromMe = (msg.getSender() == client->getUserId());
+        msgInfo.timestamp = msg.getTimestamp();
+        msgInfo.seq = msg.getSeq();
+        page.prepend(msgInfo);
+        addMessageToUI(msgInfo.text, msgInfo.isFromMe, msgInfo.timestamp,
+                       msgInfo.seq, true);
+    }
+    userMessages[currentUserId] = page + userMessages[currentUserId];
+
+    // Keep the view anchored on the message the user was looking at
+    QTimer::singleShot(0, this, [this, distanceFromBottom]() {
+        QScrollBar *bar = messageArea->verticalScrollBar();
+        bar->setValue(bar->maximum() - distanceFromBottom);
+    });
+
+    qDebug() << "Loaded" << olderMessages.size()
+             << "older messages before seq" << oldestSeq;
 }
 
 // Add these missing method implementations after refreshOnlineStatus()